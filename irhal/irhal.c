@@ -12,6 +12,9 @@ int irhal_init(struct irhal* hal, struct irhal_hal_ops* hal_ops, uint64_t max_ti
   hal->max_time_val = max_time_val;
   hal->timescale = timescale;
   hal->hal_ops = *hal_ops;
+#ifdef IRDA_STATIC_ALLOC
+  hal->num_timers = IRHAL_NUM_TIMER_STATIC;
+#else
   hal->timers = calloc(IRHAL_NUM_TIMER_DEFAULT, sizeof(struct irhal_timer));
   if(!hal->timers) {
     err = -ENOMEM;
@@ -23,6 +26,7 @@ int irhal_init(struct irhal* hal, struct irhal_hal_ops* hal_ops, uint64_t max_ti
     goto fail_timers;
   }
   hal->num_timers = IRHAL_NUM_TIMER_DEFAULT;
+#endif
   err = irhal_lock_alloc_reentrant(hal, &hal->timer_lock);
   if(err) {
     goto fail_fire_list;
@@ -30,10 +34,12 @@ int irhal_init(struct irhal* hal, struct irhal_hal_ops* hal_ops, uint64_t max_ti
   return 0;
 
 fail_fire_list:
+#ifndef IRDA_STATIC_ALLOC
   free(hal->fire_list);
 fail_timers:
   free(hal->timers);
 fail:
+#endif
   return err;
 }
 
@@ -169,6 +175,10 @@ static int irhal_set_timer_(struct irhal* hal, struct irhal_timer* timer, const
 }
 
 static int irhal_request_timers_(struct irhal* hal) {
+#ifdef IRDA_STATIC_ALLOC
+  IRHAL_LOGW(hal, "All %zu timers in use", hal->num_timers);
+  return -ENOBUFS;
+#else
   size_t new_num_timers = hal->num_timers + IRHAL_NUM_TIMER_DEFAULT;
   struct irhal_timer_fire* new_fire_list;
   struct irhal_timer* new_timers = realloc(hal->timers, sizeof(struct irhal_timer) * new_num_timers);
@@ -186,6 +196,7 @@ static int irhal_request_timers_(struct irhal* hal) {
   hal->fire_list = new_fire_list;
   hal->num_timers = new_num_timers;
   return 0;
+#endif
 }
 
 int irhal_set_timer(struct irhal* hal, time_ns_t* timeout, irhal_timer_cb cb, void* priv) {
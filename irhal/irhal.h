@@ -8,6 +8,11 @@
 #define IRHAL_NUM_TIMER_DEFAULT 8
 #define IRHAL_TIMER_INVALID -1
 
+// Fixed number of timers with IRDA_STATIC_ALLOC, timer table never grows
+#ifndef IRHAL_NUM_TIMER_STATIC
+#define IRHAL_NUM_TIMER_STATIC 16
+#endif
+
 #define IRHAL_LOG_LEVEL_NONE    0
 #define IRHAL_LOG_LEVEL_ERROR   1
 #define IRHAL_LOG_LEVEL_WARNING 2
@@ -57,11 +62,30 @@ struct irhal_hal_ops {
   irhal_lock_put_f         lock_put_reentrant;
 };
 
+typedef void (*irhal_timer_cb)(void* priv);
+
+struct irhal_timer_fire {
+  irhal_timer_cb cb;
+  void* priv;
+};
+
+struct irhal_timer {
+  bool enabled;
+  irhal_timer_cb cb;
+  void* priv; 
+  time_ns_t deadline;
+};
+
 struct irhal {
   uint64_t max_time_val;
   uint64_t timescale;
+#ifdef IRDA_STATIC_ALLOC
+  struct irhal_timer timers[IRHAL_NUM_TIMER_STATIC];
+  struct irhal_timer_fire fire_list[IRHAL_NUM_TIMER_STATIC];
+#else
   struct irhal_timer* timers;
   struct irhal_timer_fire* fire_list;
+#endif
   struct irhal_hal_ops hal_ops;
   size_t num_timers;
   uint64_t last_timestamp;
@@ -71,19 +95,6 @@ struct irhal {
   void* priv;
 };
 
-typedef void (*irhal_timer_cb)(void* priv);
-
-struct irhal_timer_fire {
-  irhal_timer_cb cb;
-  void* priv;
-};
-
-struct irhal_timer {
-  bool enabled;
-  irhal_timer_cb cb;
-  void* priv; 
-  time_ns_t deadline;
-};
 
 
 int irhal_init(struct irhal* hal, struct irhal_hal_ops* hal_ops, uint64_t max_time_val, uint64_t timescale);
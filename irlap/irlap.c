@@ -22,9 +22,12 @@
 static struct irlap_frame_handler frame_handlers[] = {
   { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_XID, irlap_discovery_handle_xid_cmd, NULL },
   { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_RESP_XID, NULL, irlap_discovery_handle_xid_resp },
-  { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_UI, irlap_unitdata_handle_ui_cmd, NULL },
+  { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_UI, irlap_unitdata_handle_ui_cmd, irlap_unitdata_handle_ui_resp },
+  { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_SNRM, irlap_connect_handle_snrm_cmd, NULL },
   { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_RESP_UA, NULL, irlap_connect_handle_ua_resp },
   { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_RESP_DM, NULL, irlap_connect_handle_dm_resp },
+  { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_DISC, irlap_connect_handle_disc_cmd, NULL },
+  { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_RESP_FRMR, NULL, irlap_data_handle_frmr_resp },
   { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_TEST, irlap_test_handle_test_cmd, NULL },
   { IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_RESP_TEST, NULL, irlap_test_handle_test_resp },
   { 0, NULL, NULL }
@@ -32,27 +35,79 @@ static struct irlap_frame_handler frame_handlers[] = {
 
 static irlap_indirection_f event_indirections[] = {
   irlap_discovery_indirect_busy,
+  irlap_tx_indirect_flush,
 };
 
 static int irlap_media_busy(struct irlap* lap);
 static void irlap_handle_irda_event(struct irphy* phy, irphy_event_t event, void* priv);
 
+#ifdef IRDA_STATIC_ALLOC
+static int irlap_pools_init(struct irlap* lap) {
+  objpool_init_storage(&lap->pools.frames, &lap->pool_storage.frames);
+  objpool_init_storage(&lap->pools.connections, &lap->pool_storage.connections);
+  objpool_init_storage(&lap->pools.data_frames, &lap->pool_storage.data_frames);
+  return 0;
+}
+#else
+static int irlap_pools_init(struct irlap* lap) {
+  int err;
+
+  err = objpool_init(&lap->pools.frames, sizeof(struct irlap_tx_request), IRLAP_POOL_NUM_FRAMES);
+  if(err) {
+    goto fail;
+  }
+
+  err = objpool_init(&lap->pools.connections, sizeof(struct irlap_connection), IRLAP_POOL_NUM_CONNECTIONS);
+  if(err) {
+    goto fail_frames;
+  }
+
+  err = objpool_init(&lap->pools.data_frames, sizeof(struct irlap_data_frame), IRLAP_POOL_NUM_DATA_FRAMES);
+  if(err) {
+    goto fail_connections;
+  }
+
+  return 0;
+
+fail_connections:
+  objpool_free(&lap->pools.connections);
+fail_frames:
+  objpool_free(&lap->pools.frames);
+fail:
+  return err;
+}
+#endif
+
+static void irlap_pools_free(struct irlap* lap) {
+  objpool_free(&lap->pools.data_frames);
+  objpool_free(&lap->pools.connections);
+  objpool_free(&lap->pools.frames);
+}
+
 int irlap_init(struct irlap* lap, struct irphy* phy, void* priv) {
   int err;
+  unsigned int i;
   memset(lap, 0, sizeof(*lap));
   lap->phy = phy;
   lap->priv = priv;
+  lap->selective_reject = IRLAP_SELECTIVE_REJECT;
+  atomic_init(&lap->address, IRLAP_ADDR_NULL);
+  atomic_init(&lap->state, IRLAP_STATION_MODE_NDM);
+  atomic_init(&lap->media_busy, false);
 
   INIT_LIST_HEAD(lap->connections);
+  for(i = IRLAP_CONNECTION_INDEX_MIN; i < IRLAP_CONNECTION_INDEX_MAX; i++) {
+    bitmap_set(lap->connection_addr_free, i);
+  }
 
-  err = irlap_regenerate_address(lap);
+  err = irlap_pools_init(lap);
   if(err) {
     goto fail;
   }
 
   err = irlap_lock_alloc_reentrant(lap, &lap->phy_lock);
   if(err) {
-    goto fail;
+    goto fail_pools;
   }
 
   err = irlap_lock_alloc_reentrant(lap, &lap->state_lock);
@@ -60,6 +115,11 @@ int irlap_init(struct irlap* lap, struct irphy* phy, void* priv) {
     goto fail_phy_lock;
   }
 
+  err = irlap_regenerate_address(lap);
+  if(err) {
+    goto fail_state_lock;
+  }
+
   err = irlap_lock_alloc_reentrant(lap, &lap->connection_lock);
   if(err) {
     goto fail_state_lock;
@@ -70,16 +130,26 @@ int irlap_init(struct irlap* lap, struct irphy* phy, void* priv) {
     goto fail_connection_lock;
   }
 
-  err = eventqueue_init(&lap->events, lap->phy->hal, 32);
+  err = irlap_wrapper_state_init(&lap->wrapper_state, IRLAP_WRAPPER_RX_SIZE(IRLAP_RX_DATA_SIZE_CONTENTION));
   if(err) {
     goto fail_discovery;
   }
 
-  err = irlap_unitdata_init(&lap->unitdata);
+  err = eventqueue_init(&lap->events, lap->phy->hal, IRLAP_EVENTQUEUE_SIZE);
+  if(err) {
+    goto fail_wrapper_state;
+  }
+
+  err = irlap_tx_init(&lap->tx);
   if(err) {
     goto fail_eventqueue;
   }
 
+  err = irlap_unitdata_init(&lap->unitdata);
+  if(err) {
+    goto fail_tx;
+  }
+
   err = irlap_connect_init(&lap->connect);
   if(err) {
     goto fail_unitdata;
@@ -101,8 +171,12 @@ fail_connect:
   irlap_connect_free(&lap->connect);
 fail_unitdata:
   irlap_unitdata_free(&lap->unitdata);
+fail_tx:
+  irlap_tx_free(&lap->tx);
 fail_eventqueue:
   eventqueue_free(&lap->events);
+fail_wrapper_state:
+  irlap_wrapper_state_free(&lap->wrapper_state);
 fail_discovery:
   irlap_discovery_free(&lap->discovery);
 fail_connection_lock:
@@ -111,6 +185,8 @@ fail_state_lock:
   irlap_lock_free_reentrant(lap, lap->state_lock);
 fail_phy_lock:
   irlap_lock_free_reentrant(lap, lap->phy_lock);
+fail_pools:
+  irlap_pools_free(lap);
 fail:
   return err;
 }
@@ -130,18 +206,16 @@ int irlap_indirect_call(struct irlap* lap, int type, void* data) {
   return eventqueue_enqueue(&lap->events, type, data);
 }
 
-bool irlap_is_media_busy(struct irlap* lap) {
-  return lap->media_busy;
-}
-
 int irlap_regenerate_address(struct irlap* lap) {
   int err;
   irlap_addr_t addr;
-  err = irhal_random_bytes(lap->phy->hal, &addr, sizeof(addr));
+  err = irhal_random_bytes(lap->phy->hal, (uint8_t*)&addr, sizeof(addr));
   if(err) {
     return err;
   }
-  lap->address = addr;
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  atomic_store_explicit(&lap->address, addr, memory_order_release);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
   return 0;
 }
 
@@ -153,64 +227,216 @@ static unsigned int irlap_get_num_extra_bof(struct irlap* lap, struct irlap_conn
   return irlap_connection_get_num_additional_bofs(conn);
 }
 
-int irlap_send_frame(struct irlap* lap, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments) {
+static uint32_t irlap_get_baudrate(struct irlap* lap, struct irlap_connection* conn) {
+  if(!conn) {
+    return IRLAP_BAUDRATE_CONTENTION;
+  }
+
+  return irlap_connection_get_baudrate(conn);
+}
+
+// Transmit spans in a single tx session, hold_tx keeps the transmitter enabled for more data to follow
+int irlap_phy_tx(struct irlap* lap, uint32_t baudrate, const struct iovec* iov, size_t iovcnt, bool hold_tx) {
   int err;
-  uint8_t* frame_data;
-  struct irlap_connection* conn;
+  ssize_t tx_len = 0;
 
-  irlap_lock_take_reentrant(lap, lap->connection_lock);
-  conn = irlap_connection_get(lap, IRLAP_CONNECTION_ADDRESS_MASK_CMD_BIT(hdr->connection_address));
-  unsigned int additional_bof = irlap_get_num_extra_bof(lap, conn);
-  if(conn) {
-    irphy_set_baudrate(lap->phy, irlap_connection_get_baudrate(conn));
+  irlap_lock_take_reentrant(lap, lap->phy_lock);
+  // Transmitter might still be enabled from a held session, make sure to turn it off on failure
+  err = irphy_set_baudrate(lap->phy, baudrate);
+  if(err) {
+    goto fail_tx;
+  }
+  err = irphy_tx_enable(lap->phy);
+  if(err) {
+    goto fail_tx;
+  }
+
+  if(irphy_has_txv(lap->phy)) {
+    tx_len = irphy_txv(lap->phy, iov, iovcnt);
   } else {
-    irphy_set_baudrate(lap->phy, IRLAP_BAUDRATE_CONTENTION);
+    while(iovcnt-- > 0 && tx_len >= 0) {
+      tx_len = irphy_tx(lap->phy, iov->iov_base, iov->iov_len);
+      iov++;
+    }
+  }
+  if(tx_len < 0) {
+    err = tx_len;
+    goto fail_tx;
+  }
+
+  err = irphy_tx_wait(lap->phy);
+  if(!err && hold_tx) {
+    goto out_phy_locked;
+  }
+fail_tx:
+  irphy_tx_disable(lap->phy);
+out_phy_locked:
+  irlap_lock_put_reentrant(lap, lap->phy_lock);
+  return err;
+}
+
+// Determine common baudrate and number of additional BOFs of each frame in a burst
+int irlap_frame_burst_prepare(struct irlap* lap, struct irlap_frame* frames, size_t num_frames, uint32_t* baudrate, unsigned int* additional_bof) {
+  size_t i;
+
+  if(num_frames > IRLAP_FRAME_BURST_MAX) {
+    IRLAP_LOGE(lap, "Burst of %zu frames exceeds maximum burst size of %u frames", num_frames, IRLAP_FRAME_BURST_MAX);
+    return -EINVAL;
+  }
+
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  for(i = 0; i < num_frames; i++) {
+    struct irlap_frame* frame = &frames[i];
+    struct irlap_connection* conn = irlap_connection_get(lap, IRLAP_CONNECTION_ADDRESS_MASK_CMD_BIT(frame->hdr->connection_address));
+    uint32_t frame_baudrate = irlap_get_baudrate(lap, conn);
+    if(i > 0 && frame_baudrate != *baudrate) {
+      IRLAP_LOGE(lap, "Can't send frames with different baudrates (%u != %u) in one burst", frame_baudrate, *baudrate);
+      irlap_lock_put_reentrant(lap, lap->connection_lock);
+      return -EINVAL;
+    }
+    *baudrate = frame_baudrate;
+    additional_bof[i] = irlap_get_num_extra_bof(lap, conn);
   }
   irlap_lock_put_reentrant(lap, lap->connection_lock);
-  ssize_t frame_size = irlap_wrapper_get_wrapped_size(IRLAP_FRAME_WRAPPER_ASYNC, hdr, fragments, num_fragments, additional_bof);
-  if(frame_size < 0) {
-    err = frame_size;
-    goto fail;
+  return 0;
+}
+
+ssize_t irlap_frame_burst_get_wrapped_size(struct irlap_frame* frames, size_t num_frames, unsigned int* additional_bof) {
+  size_t i;
+  size_t burst_size = 0;
+
+  for(i = 0; i < num_frames; i++) {
+    struct irlap_frame* frame = &frames[i];
+    ssize_t frame_size;
+    if(frame->wrapped) {
+      frame_size = irlap_wrapper_get_prewrapped_size(IRLAP_FRAME_WRAPPER_ASYNC, frame->hdr, frame->wrapped, additional_bof[i]);
+    } else {
+      frame_size = irlap_wrapper_get_wrapped_size(IRLAP_FRAME_WRAPPER_ASYNC, frame->hdr, frame->fragments, frame->num_fragments, additional_bof[i]);
+    }
+    if(frame_size < 0) {
+      return frame_size;
+    }
+    burst_size += frame_size;
   }
 
-  frame_data = malloc(frame_size);
-  if(!frame_data) {
-    err = -ENOMEM;
-    goto fail;
+  return burst_size;
+}
+
+ssize_t irlap_frame_burst_wrap(uint8_t* dst, size_t dst_len, struct irlap_frame* frames, size_t num_frames, unsigned int* additional_bof) {
+  size_t i;
+  uint8_t* frame_ptr = dst;
+
+  for(i = 0; i < num_frames; i++) {
+    struct irlap_frame* frame = &frames[i];
+    ssize_t frame_size;
+    if(frame->wrapped) {
+      frame_size = irlap_wrapper_wrap_prewrapped(IRLAP_FRAME_WRAPPER_ASYNC, frame_ptr, dst_len - (frame_ptr - dst), frame->hdr, frame->wrapped, additional_bof[i]);
+    } else {
+      frame_size = irlap_wrapper_wrap(IRLAP_FRAME_WRAPPER_ASYNC, frame_ptr, dst_len - (frame_ptr - dst), frame->hdr, frame->fragments, frame->num_fragments, additional_bof[i]);
+    }
+    if(frame_size < 0) {
+      return frame_size;
+    }
+    frame_ptr += frame_size;
+  }
+
+  return frame_ptr - dst;
+}
+
+static ssize_t irlap_frame_burst_wrap_iov(struct iovec* iov, size_t max_iov, struct irlap_wrapper_iov_scratch* scratch, struct irlap_frame* frames, size_t num_frames, unsigned int* additional_bof) {
+  size_t i;
+  size_t iovcnt = 0;
+
+  for(i = 0; i < num_frames; i++) {
+    struct irlap_frame* frame = &frames[i];
+    ssize_t frame_iovcnt;
+    if(frame->wrapped) {
+      frame_iovcnt = irlap_wrapper_wrap_prewrapped_iov(IRLAP_FRAME_WRAPPER_ASYNC, &iov[iovcnt], max_iov - iovcnt, &scratch[i], frame->hdr, frame->wrapped, additional_bof[i]);
+    } else {
+      frame_iovcnt = irlap_wrapper_wrap_iov(IRLAP_FRAME_WRAPPER_ASYNC, &iov[iovcnt], max_iov - iovcnt, &scratch[i], frame->hdr, frame->fragments, frame->num_fragments, additional_bof[i]);
+    }
+    if(frame_iovcnt < 0) {
+      return frame_iovcnt;
+    }
+    iovcnt += frame_iovcnt;
   }
 
-  frame_size = irlap_wrapper_wrap(IRLAP_FRAME_WRAPPER_ASYNC, frame_data, frame_size, hdr, fragments, num_fragments, additional_bof);
-  if(frame_size < 0) {
-    err = frame_size;
-    goto fail_alloc;
+  return iovcnt;
+}
+
+// Wrap each frame into a pooled buffer and transmit them in one go
+static int irlap_send_frame_burst_flat(struct irlap* lap, uint32_t baudrate, struct irlap_frame* frames, size_t num_frames, unsigned int* additional_bof) {
+  int err = 0;
+  size_t i, num_bufs = 0;
+  struct irlap_tx_request* bufs[IRLAP_FRAME_BURST_MAX];
+  struct iovec iov[IRLAP_FRAME_BURST_MAX];
+
+  for(i = 0; i < num_frames; i++) {
+    ssize_t frame_len;
+    struct irlap_tx_request* buf = objpool_get(&lap->pools.frames);
+    if(!buf) {
+      IRLAP_LOGW(lap, "Frame buffer pool exhausted");
+      err = -ENOBUFS;
+      goto fail_bufs;
+    }
+    bufs[num_bufs++] = buf;
+
+    frame_len = irlap_frame_burst_wrap(buf->data, sizeof(buf->data), &frames[i], 1, &additional_bof[i]);
+    if(frame_len < 0) {
+      err = frame_len;
+      goto fail_bufs;
+    }
+    iov[i].iov_base = buf->data;
+    iov[i].iov_len = frame_len;
   }
 
-/*
-  IRLAP_LOGD(lap, "==== Wrapped frame START ====");
-  for(size_t i = 0; i < frame_size; i++) {
-    printf("%02x ", frame_data[i]);
+  err = irlap_phy_tx(lap, baudrate, iov, num_frames, false);
+fail_bufs:
+  while(num_bufs-- > 0) {
+    objpool_put(&lap->pools.frames, bufs[num_bufs]);
   }
-  printf("\n");
-  IRLAP_LOGD(lap, "==== Wrapped frame END ====");
-*/
-  err = irphy_tx_enable(lap->phy);
+  return err;
+}
+
+// Send all frames back to back in a single tx session with one turnaround at the end
+int irlap_send_frame_burst(struct irlap* lap, struct irlap_frame* frames, size_t num_frames) {
+  int err;
+  uint32_t baudrate;
+  unsigned int additional_bof[IRLAP_FRAME_BURST_MAX];
+
+  if(num_frames == 0) {
+    return 0;
+  }
+
+  err = irlap_frame_burst_prepare(lap, frames, num_frames, &baudrate, additional_bof);
   if(err) {
-    goto fail_alloc;
+    return err;
   }
 
-  frame_size = irphy_tx(lap->phy, frame_data, frame_size);
-  if(frame_size < 0) {
-    err = frame_size;
-    goto fail_tx;
+  if(irphy_has_txv(lap->phy)) {
+    struct iovec iov[IRLAP_FRAME_BURST_IOV_MAX];
+    struct irlap_wrapper_iov_scratch scratch[IRLAP_FRAME_BURST_MAX];
+    ssize_t iovcnt = irlap_frame_burst_wrap_iov(iov, ARRAY_LEN(iov), scratch, frames, num_frames, additional_bof);
+    if(iovcnt >= 0) {
+      return irlap_phy_tx(lap, baudrate, iov, iovcnt, false);
+    }
+    // Too many escaped bytes for our iovec array, coalesce into a single buffer instead
+    if(iovcnt != -ENOBUFS) {
+      return iovcnt;
+    }
   }
 
-  err = irphy_tx_wait(lap->phy);
-fail_tx:
-  irphy_tx_disable(lap->phy);
-fail_alloc:
-  free(frame_data);
-fail:
-  return err;
+  return irlap_send_frame_burst_flat(lap, baudrate, frames, num_frames, additional_bof);
+}
+
+int irlap_send_frame(struct irlap* lap, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments) {
+  struct irlap_frame frame = {
+    .hdr = hdr,
+    .fragments = fragments,
+    .num_fragments = num_fragments,
+  };
+
+  return irlap_send_frame_burst(lap, &frame, 1);
 }
 
 int irlap_send_frame_single(struct irlap* lap, irlap_frame_hdr_t* hdr, uint8_t* payload, size_t payload_len) {
@@ -254,12 +480,43 @@ void irlap_lock_put_reentrant(struct irlap* lap, void* lock) {
   irhal_lock_put_reentrant(lap->phy->hal, lock);
 }
 
-irlap_addr_t irlap_get_address(struct irlap* lap) {
-  irlap_addr_t addr;
-  irlap_lock_take_reentrant(lap, lap->state_lock);
-  addr = lap->address;
-  irlap_lock_put_reentrant(lap, lap->state_lock);
-  return addr;
+// Phy switches to baudrate once the current tx session has ended
+int irlap_set_baudrate_at_turnaround(struct irlap* lap, uint32_t baudrate) {
+  int err;
+
+  irlap_lock_take_reentrant(lap, lap->phy_lock);
+  err = irphy_set_baudrate_at_turnaround(lap->phy, baudrate, 0);
+  irlap_lock_put_reentrant(lap, lap->phy_lock);
+  return err;
+}
+
+// Size rx reassembly buffer for frames carrying up to data_size bytes of information
+void irlap_set_rx_data_size(struct irlap* lap, size_t data_size) {
+  irlap_wrapper_state_resize(&lap->wrapper_state, IRLAP_WRAPPER_RX_SIZE(data_size));
+}
+
+size_t irlap_get_rx_overruns(struct irlap* lap) {
+  return irlap_wrapper_get_overruns(&lap->wrapper_state);
+}
+
+// Applies to connections established afterwards
+void irlap_set_selective_reject(struct irlap* lap, bool enable) {
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  lap->selective_reject = enable;
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+}
+
+// Used to pick window and data size of connections established afterwards
+void irlap_set_link_error_rate(struct irlap* lap, uint32_t bit_error_rate_ppb) {
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  lap->link_error_rate_ppb = bit_error_rate_ppb;
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+}
+
+void irlap_get_pool_stats(struct irlap* lap, struct irlap_pool_stats* stats) {
+  objpool_get_stats(&lap->pools.frames, &stats->frames);
+  objpool_get_stats(&lap->pools.connections, &stats->connections);
+  objpool_get_stats(&lap->pools.data_frames, &stats->data_frames);
 }
 
 irphy_capability_baudrate_t irlap_get_supported_baudrates(struct irlap* lap) {
@@ -267,9 +524,10 @@ irphy_capability_baudrate_t irlap_get_supported_baudrates(struct irlap* lap) {
 }
 
 int irlap_set_timer(struct irlap* lap, unsigned int timeout_ms, irhal_timer_cb cb, void* priv) {
-  time_ns_t timeout = { .sec = 0 };
-  timeout.nsec = (uint32_t)timeout_ms * 1000000UL;
-  time_normalize(&timeout);
+  time_ns_t timeout = {
+    .sec = timeout_ms / 1000,
+    .nsec = (timeout_ms % 1000) * 1000000UL,
+  };
   return irhal_set_timer(lap->phy->hal, &timeout, cb, priv);
 }
 
@@ -298,6 +556,11 @@ int irlap_handle_frame(uint8_t* data, size_t len, void* priv) {
     goto out_connections_locked;
   }
   IRLAP_LOGV(lap, "Frame control: %02x", frame_hdr.control);
+  // I and S frames carry sequence numbers, the data phase handles them all
+  if(!IRLAP_FRAME_IS_UNNUMBERED(&frame_hdr)) {
+    irlap_data_handle_frame(lap, conn, &frame_hdr, data, len);
+    goto out_connections_locked;
+  }
   while(hndlr->handle_cmd != NULL || hndlr->handle_resp != NULL) {
     if(IRLAP_FRAME_MASK_POLL_FINAL(frame_hdr.control) != IRLAP_FRAME_MASK_POLL_FINAL(hndlr->control)) {
       IRLAP_LOGV(lap, "Frame control %02x != %02x", IRLAP_FRAME_MASK_POLL_FINAL(frame_hdr.control), IRLAP_FRAME_MASK_POLL_FINAL(hndlr->control));
@@ -331,7 +594,7 @@ void irlap_media_busy_timeout(void* arg) {
   irlap_lock_take_reentrant(lap, lap->state_lock);
   lap->media_busy_counter = 0;
   lap->media_busy_timer = 0;
-  lap->media_busy = false;
+  atomic_store_explicit(&lap->media_busy, false, memory_order_release);
   irlap_lock_put_reentrant(lap, lap->state_lock);
 }
 
@@ -340,7 +603,7 @@ static int irlap_media_busy(struct irlap* lap) {
   irlap_lock_take_reentrant(lap, lap->state_lock);
   if(++lap->media_busy_counter >= IRLAP_MEDIA_BUSY_THRESHOLD) {
     lap->media_busy_counter = 0;
-    lap->media_busy = true;
+    atomic_store_explicit(&lap->media_busy, true, memory_order_release);
     if(lap->media_busy_timer) {
       irlap_clear_timer(lap, lap->media_busy_timer);
       lap->media_busy_timer = 0;
@@ -348,7 +611,7 @@ static int irlap_media_busy(struct irlap* lap) {
     err = irlap_set_timer(lap, IRLAP_MEDIA_BUSY_TIMEOUT, irlap_media_busy_timeout, lap);
     if(err < 0) {
       IRLAP_LOGW(lap, "Failed to start media busy timer, clearing busy flag");
-      lap->media_busy = false;
+      atomic_store_explicit(&lap->media_busy, false, memory_order_release);
     } else {
       lap->media_busy_timer = err;
     }
@@ -357,20 +620,47 @@ static int irlap_media_busy(struct irlap* lap) {
   return err < 0 ? err : 0;
 }
 
-static void irlap_handle_irda_event(struct irphy* phy, irphy_event_t event, void* priv) {
-  struct irlap* lap = priv;
+static int irlap_handle_rx_copy(struct irlap* lap) {
   int err = 0;
   uint8_t buff[128];
   ssize_t read_len;
+  while((read_len = irphy_rx(lap->phy, buff, sizeof(buff))) > 0) {
+    if(irlap_wrapper_unwrap(IRLAP_FRAME_WRAPPER_ASYNC, &lap->wrapper_state, buff, read_len, irlap_handle_frame, lap)) {
+      err = 1;
+    }
+  }
+  if(read_len < 0) {
+    IRLAP_LOGE(lap, "Failed to read from infrared phy: %zd", read_len);
+  }
+  return err;
+}
+
+// Unwrap directly from the phy driver's receive buffer
+static int irlap_handle_rx_peek(struct irlap* lap) {
+  int err = 0;
+  const void* data;
+  ssize_t read_len;
+  while((read_len = irphy_rx_peek(lap->phy, &data)) > 0) {
+    if(irlap_wrapper_unwrap(IRLAP_FRAME_WRAPPER_ASYNC, &lap->wrapper_state, data, read_len, irlap_handle_frame, lap)) {
+      err = 1;
+    }
+    irphy_rx_consume(lap->phy, read_len);
+  }
+  if(read_len < 0) {
+    IRLAP_LOGE(lap, "Failed to peek into infrared phy rx buffer: %zd", read_len);
+  }
+  return err;
+}
+
+static void irlap_handle_irda_event(struct irphy* phy, irphy_event_t event, void* priv) {
+  struct irlap* lap = priv;
+  int err;
   switch(event) {
     case IRPHY_EVENT_DATA_RX:
-      while((read_len = irphy_rx(lap->phy, buff, sizeof(buff))) > 0) {
-        if(irlap_wrapper_unwrap(IRLAP_FRAME_WRAPPER_ASYNC, &lap->wrapper_state, buff, read_len, irlap_handle_frame, lap)) {
-          err = 1;
-        }
-      }
-      if(read_len < 0) {
-        IRLAP_LOGE(lap, "Failed to read from infrared phy: %zd", read_len);
+      if(irphy_has_rx_peek(lap->phy)) {
+        err = irlap_handle_rx_peek(lap);
+      } else {
+        err = irlap_handle_rx_copy(lap);
       }
       if(err) {
         irlap_media_busy(lap);
@@ -2,47 +2,49 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include "irlap_defs.h"
 #include "irlap.h"
 
 #include "../util/eventqueue.h"
 
-union irlap_frame_hdr {
-  struct {
-    irlap_connection_addr_t connection_address;
-    irlap_control_t control;
-  };
-  uint8_t data[2];
-};
-
-typedef union irlap_frame_hdr irlap_frame_hdr_t;
-
 struct irlap;
 
 #include "irlap_discovery.h"
 #include "irlap_unitdata.h"
 #include "irlap_connect.h"
+#include "irlap_data.h"
 #include "irlap_frame_wrapper.h"
 #include "irlap_test.h"
+#include "irlap_tx.h"
 #include "../irphy/irphy.h"
+#include "../util/bitmap.h"
 #include "../util/list.h"
+#include "../util/objpool.h"
 
 struct irlap {
   void* priv;
   struct irphy* phy;
 
-  irlap_addr_t address;
+  // Published for lock-free readers, writers must hold state_lock
+  _Atomic(irlap_addr_t) address;
+  _Atomic(irlap_station_mode_t) state;
+  atomic_bool media_busy;
 
-  irlap_station_mode_t state;
   irlap_station_role_t role;
-  bool media_busy;
   int media_busy_timer;
   size_t media_busy_counter;
 
   unsigned int additional_bof;
+  bool selective_reject;
+  // Expected bit error rate in parts per billion, 0 if unknown
+  uint32_t link_error_rate_ppb;
 
   irlap_connection_list_t connections;
+  struct irlap_negotiation_context negotiation;
+  struct irlap_connection* connection_table[IRLAP_CONNECTION_TABLE_SIZE];
+  BITMAP_DECLARE(connection_addr_free, IRLAP_CONNECTION_TABLE_SIZE);
   void* connection_lock;
 
   struct irlap_discovery discovery;
@@ -54,16 +56,33 @@ struct irlap {
 
   struct eventqueue events;
 
+  struct irlap_tx_queue tx;
+
   struct irlap_unitdata unitdata;
 
   struct irlap_connect connect;
 
+  struct {
+    struct objpool frames;
+    struct objpool connections;
+    struct objpool data_frames;
+  } pools;
+
+#ifdef IRDA_STATIC_ALLOC
+  struct {
+    OBJPOOL_STORAGE_DECLARE(frames, struct irlap_tx_request, IRLAP_POOL_NUM_FRAMES);
+    OBJPOOL_STORAGE_DECLARE(connections, struct irlap_connection, IRLAP_POOL_NUM_CONNECTIONS);
+    OBJPOOL_STORAGE_DECLARE(data_frames, struct irlap_data_frame, IRLAP_POOL_NUM_DATA_FRAMES);
+  } pool_storage;
+#endif
+
   struct {
     struct irlap_service_discovery discovery;
     struct irlap_service_new_address new_address;
     struct irlap_service_unitdata unitdata;
     struct irlap_service_disconnect disconnect;
     struct irlap_service_connect connect;
+    struct irlap_service_data data;
     struct irlap_service_test test;
   } services;
 };
@@ -83,11 +102,26 @@ struct irlap_data_fragment {
   size_t len;
 };
 
+struct irlap_frame {
+  irlap_frame_hdr_t* hdr;
+  struct irlap_data_fragment* fragments;
+  size_t num_fragments;
+  // Used instead of fragments if set
+  struct irlap_wrapped_payload* wrapped;
+  // Owner of the wrapped payload, queued frames reference the payload instead of copying it
+  struct irlap_data_buffer* ref;
+};
+
+struct irlap_pool_stats {
+  struct objpool_stats frames;
+  struct objpool_stats connections;
+  struct objpool_stats data_frames;
+};
+
 int irlap_init(struct irlap* lap, struct irphy* phy, void* priv);
 void irlap_event_loop(struct irlap* lap);
 int irlap_indirect_call(struct irlap* lap, int type, void* data);
 int irlap_regenerate_address(struct irlap* lap);
-bool irlap_is_media_busy(struct irlap* lap);
 int irlap_lock_alloc(struct irlap* lap, void** lock);
 void irlap_lock_free(struct irlap* lap, void* lock);
 void irlap_lock_take(struct irlap* lap, void* lock);
@@ -96,12 +130,34 @@ int irlap_lock_alloc_reentrant(struct irlap* lap, void** lock);
 void irlap_lock_free_reentrant(struct irlap* lap, void* lock);
 void irlap_lock_take_reentrant(struct irlap* lap, void* lock);
 void irlap_lock_put_reentrant(struct irlap* lap, void* lock);
-irlap_addr_t irlap_get_address(struct irlap* lap);
 int irlap_set_timer(struct irlap* lap, unsigned int timeout_ms, irhal_timer_cb cb, void* priv);
 int irlap_clear_timer(struct irlap* lap, int timer);
+int irlap_phy_tx(struct irlap* lap, uint32_t baudrate, const struct iovec* iov, size_t iovcnt, bool hold_tx);
+int irlap_frame_burst_prepare(struct irlap* lap, struct irlap_frame* frames, size_t num_frames, uint32_t* baudrate, unsigned int* additional_bof);
+ssize_t irlap_frame_burst_get_wrapped_size(struct irlap_frame* frames, size_t num_frames, unsigned int* additional_bof);
+ssize_t irlap_frame_burst_wrap(uint8_t* dst, size_t dst_len, struct irlap_frame* frames, size_t num_frames, unsigned int* additional_bof);
+int irlap_send_frame_burst(struct irlap* lap, struct irlap_frame* frames, size_t num_frames);
 int irlap_send_frame(struct irlap* lap, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments);
 int irlap_send_frame_single(struct irlap* lap, irlap_frame_hdr_t* hdr, uint8_t* payload, size_t payload_len);
 irphy_capability_baudrate_t irlap_get_supported_baudrates(struct irlap* lap);
+void irlap_get_pool_stats(struct irlap* lap, struct irlap_pool_stats* stats);
+int irlap_set_baudrate_at_turnaround(struct irlap* lap, uint32_t baudrate);
+void irlap_set_rx_data_size(struct irlap* lap, size_t data_size);
+size_t irlap_get_rx_overruns(struct irlap* lap);
+void irlap_set_selective_reject(struct irlap* lap, bool enable);
+void irlap_set_link_error_rate(struct irlap* lap, uint32_t bit_error_rate_ppb);
+
+static inline irlap_addr_t irlap_get_address(struct irlap* lap) {
+  return atomic_load_explicit(&lap->address, memory_order_acquire);
+}
+
+static inline irlap_station_mode_t irlap_get_state(struct irlap* lap) {
+  return atomic_load_explicit(&lap->state, memory_order_acquire);
+}
+
+static inline bool irlap_is_media_busy(struct irlap* lap) {
+  return atomic_load_explicit(&lap->media_busy, memory_order_acquire);
+}
 
 #define irlap_random_u8(lap, val, min, max) (irhal_random_u8((lap)->phy->hal, (val), (min), (max)))
 
@@ -58,20 +58,84 @@ fail_state_locked:
   return err;
 }
 
-static void sniff_snrm_p_timeout(void* priv) {
-  struct irlap_connection* conn = priv;
+static void snrm_abort(struct irlap_connection* conn) {
   struct irlap* lap = conn->lap;
   irlap_lock_take_reentrant(lap, lap->state_lock);
   lap->state = IRLAP_STATION_MODE_NDM;
+  lap->role = IRLAP_STATION_ROLE_NONE;
   irlap_lock_take_reentrant(lap, lap->connection_lock);
   if(lap->services.disconnect.indication) {
     lap->services.disconnect.indication(conn->connection_addr, NULL, lap->priv);
   }
   irlap_connection_free(conn);
   irlap_lock_put_reentrant(lap, lap->connection_lock);
-  irlap_lock_put_reentrant(lap, lap->state_lock);  
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+static void snrm_sent(struct irlap* lap, int err, void* priv);
+
+// Sniffers get a single chance, regular connect requests repeat the snrm cmd a few times
+static void snrm_p_timeout(void* priv) {
+  struct irlap_connection* conn = priv;
+  struct irlap* lap = conn->lap;
+  int err;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  if(irlap_connection_get(lap, conn->connection_addr) != conn) {
+    goto out_locked;
+  }
+
+  conn->p_timer = IRHAL_TIMER_INVALID;
+  if(lap->state != IRLAP_STATION_MODE_SETUP || ++lap->connect.snrm_retries >= IRLAP_CONNECT_SNRM_RETRIES_MAX) {
+    IRLAP_CONN_LOGD(&lap->connect, "No answer to snrm cmd, giving up");
+    snrm_abort(conn);
+    goto out_locked;
+  }
+
+  err = irlap_connection_queue_snrm_cmd(conn, snrm_sent, (void*)(uintptr_t)conn->connection_addr);
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to queue snrm connect cmd: %d", err);
+    snrm_abort(conn);
+  }
+
+out_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
 }
 
+// P timer starts once the snrm cmd has actually left the phy
+static void snrm_sent(struct irlap* lap, int err, void* priv) {
+  irlap_connection_addr_t connection_addr = (irlap_connection_addr_t)(uintptr_t)priv;
+  struct irlap_connection* conn;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, connection_addr);
+  // Connection setup might have been answered or aborted while the snrm cmd was queued
+  if(!conn || (lap->state != IRLAP_STATION_MODE_SSETUP && lap->state != IRLAP_STATION_MODE_SETUP) || IRLAP_CONNECTION_IS_NEGOTIATED(conn)) {
+    goto out_locked;
+  }
+
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to send snrm connect cmd: %d", err);
+    snrm_abort(conn);
+    goto out_locked;
+  }
+
+  err = irlap_connection_start_p_timer(conn, snrm_p_timeout);
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to start p timer: %d", err);
+    snrm_abort(conn);
+  }
+
+out_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+// Local values describe what we receive, remote values what we send. We are free to send less than
+// the remote accepts, pick whatever promises the best goodput on this link
 static int negotiate_params(struct irlap_connection* conn, irlap_negotiation_params_t* remote_params) {
   int err = irlap_negotiation_merge_params(&conn->local_negotiation_params, remote_params);
   if(err) {
@@ -81,12 +145,277 @@ static int negotiate_params(struct irlap_connection* conn, irlap_negotiation_par
   if(err) {
     return err;
   }
-  return irlap_negotiation_translate_params_to_values(&conn->remote_negotiation_values, remote_params);
+  err = irlap_negotiation_translate_params_to_values(&conn->remote_negotiation_values, remote_params);
+  if(err) {
+    return err;
+  }
+  return irlap_negotiation_solve_tx_values(&conn->remote_negotiation_values, conn->lap->link_error_rate_ppb);
 }
 
-int irlap_connect_request(struct irlap_connect* conn, irlap_addr_t target_addr, struct irlap_connect_req_qos* qos, bool sniff) {
+// Restrict what we offer to the remote to the limits requested by the upper layer
+static int apply_req_qos(struct irlap_connection* conn, struct irlap_connect_req_qos* qos) {
+  irlap_negotiation_values_t limits = {
+    .baudrate = qos->baudrate,
+    .max_turn_around_time_ms = qos->max_turn_around_time,
+    .data_size = qos->data_size,
+    .disconnect_threshold_time_s = qos->disconnect_threshold,
+  };
+
+  return irlap_negotiation_limit_params(&conn->local_negotiation_params, &limits);
+}
+
+static int irlap_connect_request_snrm(struct irlap_connect* conn, irlap_addr_t target_addr, struct irlap_connect_req_qos* qos) {
   struct irlap* lap = IRLAP_CONNECT_TO_IRLAP(conn);
+  struct irlap_connection* connection;
+  int err;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  if(lap->state != IRLAP_STATION_MODE_NDM) {
+    IRLAP_CONN_LOGW(conn, "Station is not in NDM state, can't connect");
+    err = -IRLAP_ERR_STATION_STATE;
+    goto fail_state_locked;
+  }
+
+  if(irlap_is_media_busy(lap)) {
+    err = -IRLAP_ERR_MEDIA_BUSY;
+    goto fail_state_locked;
+  }
+
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  err = irlap_connection_alloc(lap, target_addr, &connection);
+  if(err) {
+    IRLAP_CONN_LOGE(conn, "Failed to allocate connection");
+    goto fail_connections_locked;
+  }
+
+  err = apply_req_qos(connection, qos);
+  if(err) {
+    IRLAP_CONN_LOGW(conn, "Requested qos can't be satisfied: %d", err);
+    goto fail_connection_alloc;
+  }
+
+  lap->state = IRLAP_STATION_MODE_SETUP;
+  conn->current_req_qos = *qos;
+  conn->current_target_addr = target_addr;
+  conn->snrm_retries = 0;
+  err = irlap_connection_queue_snrm_cmd(connection, snrm_sent, (void*)(uintptr_t)connection->connection_addr);
+  if(err) {
+    IRLAP_CONN_LOGE(conn, "Failed to queue snrm connect cmd");
+    lap->state = IRLAP_STATION_MODE_NDM;
+    goto fail_connection_alloc;
+  }
+
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  return 0;
+
+fail_connection_alloc:
+  irlap_connection_free(connection);
+fail_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+fail_state_locked:
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  return err;
+}
+
+int irlap_connect_request(struct irlap_connect* conn, irlap_addr_t target_addr, struct irlap_connect_req_qos* qos, bool sniff) {
+  if(sniff) {
+    return irlap_connect_request_sniff(conn, target_addr, qos);
+  }
+  return irlap_connect_request_snrm(conn, target_addr, qos);
+}
 
+// Link quality fallback: IrLAP has no way to change parameters of a running connection, the
+// connection is taken down with a disc cmd and set up again under the same connection address
+static void fallback_reconnect(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+  struct irlap_connect* connect = &lap->connect;
+  unsigned int dropped;
+  int err;
+
+  irlap_connection_stop_p_timer(conn);
+  dropped = irlap_data_reset(conn);
+  if(dropped) {
+    // Connection comes back with a new connect confirm, the upper layer has to resend what it needs
+    IRLAP_CONN_LOGW(connect, "Dropped %u unacknowledged frames on reconnect", dropped);
+    if(lap->services.disconnect.indication) {
+      lap->services.disconnect.indication(conn->connection_addr, NULL, lap->priv);
+    }
+  }
+  // Response times measured at the old speed are meaningless now
+  memset(&conn->rtt, 0, sizeof(conn->rtt));
+  irlap_connection_set_default_negotiation_params(lap, &conn->local_negotiation_params);
+  err = apply_req_qos(conn, &connect->current_req_qos);
+  if(!err && connect->fallback_addr == conn->remote_address) {
+    err = apply_req_qos(conn, &connect->fallback_qos);
+  }
+  if(err) {
+    IRLAP_CONN_LOGW(connect, "Fallback qos can't be satisfied: %d", err);
+    snrm_abort(conn);
+    return;
+  }
+
+  lap->state = IRLAP_STATION_MODE_SETUP;
+  conn->connection_state = IRLAP_CONNECTION_STATE_SETUP;
+  connect->snrm_retries = 0;
+  irlap_set_rx_data_size(lap, IRLAP_RX_DATA_SIZE_CONTENTION);
+  err = irlap_connection_queue_snrm_cmd(conn, snrm_sent, (void*)(uintptr_t)conn->connection_addr);
+  if(err) {
+    IRLAP_CONN_LOGE(connect, "Failed to queue snrm connect cmd: %d", err);
+    snrm_abort(conn);
+  }
+}
+
+static void fallback_disc_p_timeout(void* priv) {
+  struct irlap_connection* conn = priv;
+  struct irlap* lap = conn->lap;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  if(irlap_connection_get(lap, conn->connection_addr) != conn) {
+    goto out_locked;
+  }
+
+  conn->p_timer = IRHAL_TIMER_INVALID;
+  // Secondary might have missed the disc cmd, it will answer the snrm cmd with a dm resp at worst
+  fallback_reconnect(conn);
+
+out_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+static void fallback_disc_sent(struct irlap* lap, int err, void* priv) {
+  irlap_connection_addr_t connection_addr = (irlap_connection_addr_t)(uintptr_t)priv;
+  struct irlap_connection* conn;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, connection_addr);
+  if(!conn || conn->connection_state != IRLAP_CONNECTION_STATE_DISC) {
+    goto out_locked;
+  }
+
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to send disc cmd: %d", err);
+    fallback_reconnect(conn);
+    goto out_locked;
+  }
+
+  err = irlap_connection_start_p_timer(conn, fallback_disc_p_timeout);
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to start p timer: %d", err);
+    fallback_reconnect(conn);
+  }
+
+out_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+// Pick the next lower or higher set of limits for the connection. Speed is traded first
+// when stepping down and data size first when stepping up. Fails with -ERANGE once there
+// is nothing left to change, limits that no longer change the outcome are dropped
+static int fallback_step(struct irlap_connection* conn, struct irlap_connect_req_qos* qos, bool step_up) {
+  uint32_t baudrate = conn->local_negotiation_values.baudrate;
+  uint32_t data_size = conn->remote_negotiation_values.data_size;
+  uint32_t next_baudrate;
+
+  if(!step_up) {
+    baudrate = irlap_negotiation_get_next_baudrate(baudrate, false);
+    if(baudrate >= IRLAP_BAUDRATE_CONTENTION) {
+      qos->baudrate = baudrate;
+      return 0;
+    }
+    if(data_size / 2 >= IRLAP_NEGOTIATION_DATA_SIZE_MIN) {
+      qos->data_size = data_size / 2;
+      return 0;
+    }
+    return -ERANGE;
+  }
+
+  if(qos->data_size) {
+    qos->data_size = qos->data_size * 2 < IRLAP_MAX_DATA_SIZE ? qos->data_size * 2 : 0;
+    return 0;
+  }
+  // Remote or phy settled below the limit already, raising it does not get any faster
+  if(qos->baudrate && qos->baudrate <= baudrate) {
+    next_baudrate = irlap_negotiation_get_next_baudrate(baudrate, true);
+    if(next_baudrate && irlap_negotiation_baudrate_is_supported(next_baudrate, irlap_get_supported_baudrates(conn->lap))) {
+      qos->baudrate = next_baudrate;
+      return 0;
+    }
+  }
+  qos->baudrate = 0;
+  return -ERANGE;
+}
+
+// Take the connection down with a disc cmd, it is set up again once the secondary answered
+static void fallback_disc(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+  irlap_frame_hdr_t hdr = {
+    .connection_address = IRLAP_FRAME_MAKE_ADDRESS_COMMAND(conn->connection_addr),
+    .control = IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_DISC | IRLAP_CMD_POLL,
+  };
+  int err;
+
+  irlap_connection_stop_p_timer(conn);
+  conn->connection_state = IRLAP_CONNECTION_STATE_DISC;
+  err = irlap_tx_queue_frame_single(&lap->tx, &hdr, NULL, 0, fallback_disc_sent, (void*)(uintptr_t)conn->connection_addr);
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to queue disc cmd: %d", err);
+    fallback_reconnect(conn);
+  }
+}
+
+// Caller must hold the connection lock
+int irlap_connect_renegotiate(struct irlap_connection* conn, bool step_up) {
+  struct irlap* lap = conn->lap;
+  struct irlap_connect* connect = &lap->connect;
+  struct irlap_connect_req_qos qos = { 0 };
+  int err;
+
+  // Taking the link down would hit all other secondaries, too
+  if(lap->role != IRLAP_STATION_ROLE_PRIMARY || conn->list.next != conn->list.prev) {
+    return -IRLAP_ERR_STATION_STATE;
+  }
+
+  // Probing for a faster link is not worth losing frames over, wait for the window to drain
+  if(step_up && irlap_data_has_unacked(&conn->data)) {
+    return -EBUSY;
+  }
+
+  if(connect->fallback_addr == conn->remote_address) {
+    qos = connect->fallback_qos;
+  }
+  err = fallback_step(conn, &qos, step_up);
+  if(err) {
+    // Running without limits already, stop probing for a faster link
+    if(step_up && connect->fallback_addr == conn->remote_address) {
+      connect->fallback_addr = IRLAP_ADDR_NULL;
+    }
+    return err;
+  }
+
+  IRLAP_CONN_LOGI(connect, "Link quality %s, reconnecting with baudrate limit %u, data size limit %u",
+                  step_up ? "good" : "poor", qos.baudrate, qos.data_size);
+  connect->fallback_addr = conn->remote_address;
+  connect->fallback_qos = qos;
+  fallback_disc(conn);
+  return 0;
+}
+
+// Link reset after a protocol error, the connection is set up again with unchanged limits.
+// Caller must hold the connection lock
+int irlap_connect_reset(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+
+  if(lap->role != IRLAP_STATION_ROLE_PRIMARY || conn->list.next != conn->list.prev) {
+    return -IRLAP_ERR_STATION_STATE;
+  }
+
+  IRLAP_CONN_LOGI(&lap->connect, "Resetting link to %08x", conn->remote_address);
+  fallback_disc(conn);
   return 0;
 }
 
@@ -109,15 +438,19 @@ int irlap_connect_handle_sniff_xid_req_sconn(struct irlap* lap, irlap_addr_t add
     goto fail_connections_locked;    
   }
 
-  err = irlap_connection_send_snrm_cmd(connection);
+  err = apply_req_qos(connection, &conn->current_req_qos);
   if(err) {
-    IRLAP_CONN_LOGE(conn, "Failed to send snrm connect cmd");
+    IRLAP_CONN_LOGW(conn, "Requested qos can't be satisfied: %d", err);
     goto fail_connection_alloc;
   }
 
-  err = irlap_connection_start_p_timer(connection, sniff_snrm_p_timeout);
-
   lap->state = IRLAP_STATION_MODE_SSETUP;
+  err = irlap_connection_queue_snrm_cmd(connection, snrm_sent, (void*)(uintptr_t)connection->connection_addr);
+  if(err) {
+    IRLAP_CONN_LOGE(conn, "Failed to queue snrm connect cmd");
+    lap->state = IRLAP_STATION_MODE_SCONN;
+    goto fail_connection_alloc;
+  }
 
   irlap_lock_put_reentrant(lap, lap->connection_lock);
   irlap_lock_put_reentrant(lap, conn->connect_lock);
@@ -132,6 +465,303 @@ fail_connect_locked:
   return err;
 }
 
+// F timer starts once the ua resp has left the phy, the primary polls us from now on
+static void ua_resp_sent(struct irlap* lap, int err, void* priv) {
+  irlap_connection_addr_t connection_addr = (irlap_connection_addr_t)(uintptr_t)priv;
+  struct irlap_connection* conn;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, connection_addr);
+  if(!conn || lap->state != IRLAP_STATION_MODE_NRM || lap->role != IRLAP_STATION_ROLE_SECONDARY) {
+    goto out_locked;
+  }
+
+  if(err) {
+    IRLAP_CONN_LOGW(&lap->connect, "Failed to send ua resp, waiting for primary to repeat snrm cmd: %d", err);
+  }
+
+  err = irlap_connection_start_f_timer(conn, irlap_data_f_timeout);
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to start f timer: %d", err);
+  }
+
+out_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+// Primary listens at contention speed until it has received our ua resp
+static int queue_ua_resp(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+  irlap_frame_hdr_t hdr = {
+    .connection_address = IRLAP_FRAME_MAKE_ADDRESS_RESPONSE(conn->connection_addr),
+    .control = IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_RESP_UA | IRLAP_RESP_FINAL,
+  };
+  int err;
+
+  err = irlap_tx_queue_frame_single_contention(&lap->tx, &hdr, lap->connect.ua_frame.data_params, lap->connect.ua_frame_len, ua_resp_sent, (void*)(uintptr_t)conn->connection_addr);
+  if(err) {
+    return err;
+  }
+  // Primary polls us at the negotiated speed right after the ua resp
+  return irlap_set_baudrate_at_turnaround(lap, conn->local_negotiation_values.baudrate);
+}
+
+// Negotiation result goes into the ua resp right away, accepting the connection only queues it
+static int prepare_ua_resp(struct irlap_connection* conn, irlap_addr_t dst_address) {
+  struct irlap* lap = conn->lap;
+  struct irlap_connect* connect = &lap->connect;
+  ssize_t params_len;
+
+  connect->ua_frame.src_address = irlap_get_address(lap);
+  connect->ua_frame.dst_address = dst_address;
+  params_len = irlap_negotiation_context_populate_params(&lap->negotiation, connect->ua_frame.negotiation_params, IRLAP_NEGOTIATION_PARAMETERS_MAX_LEN, &conn->local_negotiation_params);
+  if(params_len < 0) {
+    return params_len;
+  }
+  connect->ua_frame_len = sizeof(connect->ua_frame.data) + params_len;
+  return 0;
+}
+
+// Caller must hold the station state lock
+static int accept_connection(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+  int err;
+
+  irlap_connection_stop_f_timer(conn);
+  err = queue_ua_resp(conn);
+  if(err) {
+    return err;
+  }
+
+  irlap_set_rx_data_size(lap, conn->local_negotiation_values.data_size);
+  conn->connection_state = IRLAP_CONNECTION_STATE_RECV;
+  lap->state = IRLAP_STATION_MODE_NRM;
+  return 0;
+}
+
+// Snrm cmd on an established connection resets the link. Primary either missed our ua resp or
+// reconnects with different limits, parameters are negotiated again in both cases
+static int reset_connection(struct irlap_connection* conn, irlap_addr_t src_address, uint8_t* data, size_t len) {
+  struct irlap* lap = conn->lap;
+  irlap_negotiation_params_t params;
+  ssize_t params_len;
+  int err;
+
+  IRLAP_CONN_LOGD(&lap->connect, "Got snrm cmd on established connection, resetting link");
+  irlap_connection_set_default_negotiation_params(lap, &params);
+  params_len = irlap_negotiation_update_params(&params, data, len);
+  if(params_len < 0) {
+    IRLAP_CONN_LOGW(&lap->connect, "Failed to decode snrm cmd negotiation params: %zd", params_len);
+    return params_len;
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  irlap_connection_stop_f_timer(conn);
+  irlap_data_reset(conn);
+  irlap_connection_set_default_negotiation_params(lap, &conn->local_negotiation_params);
+  err = negotiate_params(conn, &params);
+  if(err) {
+    IRLAP_CONN_LOGW(&lap->connect, "Failed to negotiate connection parameters: %d", err);
+    goto fail_state_locked;
+  }
+  err = prepare_ua_resp(conn, src_address);
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to write connection parameters to ua resp frame");
+    goto fail_state_locked;
+  }
+
+  err = queue_ua_resp(conn);
+  if(err) {
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to queue ua resp: %d", err);
+    goto fail_state_locked;
+  }
+  irlap_set_rx_data_size(lap, conn->local_negotiation_values.data_size);
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+  return IRLAP_FRAME_HANDLED;
+
+fail_state_locked:
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+  irlap_connection_close(conn);
+  return err;
+}
+
+// Upper layer did not answer the connect indication in time, primary will repeat its snrm cmd
+static void conn_response_timeout(void* priv) {
+  struct irlap_connection* conn = priv;
+  struct irlap* lap = conn->lap;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  if(irlap_connection_get(lap, conn->connection_addr) != conn) {
+    goto out_locked;
+  }
+
+  conn->f_timer = IRHAL_TIMER_INVALID;
+  if(lap->state == IRLAP_STATION_MODE_CONN && !IRLAP_CONNECTION_IS_NEGOTIATED(conn)) {
+    IRLAP_CONN_LOGD(&lap->connect, "No connect response from upper layer");
+    snrm_abort(conn);
+  }
+
+out_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+// Accept a connection signalled through the connect indication, may be called from within the indication
+int irlap_connect_response(struct irlap_connect* conn, irlap_connection_addr_t hndl) {
+  struct irlap* lap = IRLAP_CONNECT_TO_IRLAP(conn);
+  struct irlap_connection* connection;
+  int err;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  if(lap->state != IRLAP_STATION_MODE_CONN) {
+    IRLAP_CONN_LOGW(conn, "No connection waiting for a response");
+    err = -IRLAP_ERR_STATION_STATE;
+    goto out_locked;
+  }
+
+  connection = irlap_connection_get(lap, hndl);
+  if(!connection || IRLAP_CONNECTION_IS_NEGOTIATED(connection)) {
+    err = -IRLAP_ERR_NO_CONNECTION;
+    goto out_locked;
+  }
+
+  err = accept_connection(connection);
+  if(err) {
+    IRLAP_CONN_LOGE(conn, "Failed to queue ua resp: %d", err);
+    snrm_abort(connection);
+  }
+
+out_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  return err;
+}
+
+// Everything needed for the ua resp is prepared right away, accepting the connection only queues it
+static int irlap_connect_handle_snrm_cmd_ndm(struct irlap* lap, union irlap_snrm_frame* frame, uint8_t* data, size_t len) {
+  struct irlap_connect* conn = &lap->connect;
+  struct irlap_connection* connection;
+  irlap_negotiation_params_t params;
+  ssize_t params_len;
+  int err;
+
+  irlap_connection_set_default_negotiation_params(lap, &params);
+  params_len = irlap_negotiation_update_params(&params, data, len);
+  if(params_len < 0) {
+    IRLAP_CONN_LOGW(conn, "Failed to decode snrm cmd negotiation params: %zd", params_len);
+    return params_len;
+  }
+
+  err = irlap_connection_alloc_addr(lap, frame->src_address, frame->connection_addr, &connection);
+  if(err) {
+    IRLAP_CONN_LOGE(conn, "Failed to allocate connection: %d", err);
+    return err;
+  }
+
+  err = negotiate_params(connection, &params);
+  if(err) {
+    IRLAP_CONN_LOGW(conn, "Failed to negotiate connection parameters: %d", err);
+    goto fail_connection_alloc;
+  }
+
+  err = prepare_ua_resp(connection, frame->src_address);
+  if(err) {
+    IRLAP_CONN_LOGE(conn, "Failed to write connection parameters to ua resp frame");
+    goto fail_connection_alloc;
+  }
+  conn->current_target_addr = frame->src_address;
+
+  lap->role = IRLAP_STATION_ROLE_SECONDARY;
+  lap->state = IRLAP_STATION_MODE_CONN;
+
+  // Without an upper layer to ask the connection is accepted right away
+  if(!lap->services.connect.indication) {
+    err = accept_connection(connection);
+    if(err) {
+      IRLAP_CONN_LOGE(conn, "Failed to queue ua resp: %d", err);
+      goto fail_state;
+    }
+    return IRLAP_FRAME_HANDLED;
+  }
+
+  err = irlap_connection_start_f_timer(connection, conn_response_timeout);
+  if(err) {
+    IRLAP_CONN_LOGE(conn, "Failed to start connect response timer: %d", err);
+    goto fail_state;
+  }
+
+  struct irlap_connect_resp_qos resp_qos = {
+    .baudrate = connection->remote_negotiation_values.baudrate,
+    .data_size = connection->remote_negotiation_values.data_size,
+    .disconnect_threshold = connection->remote_negotiation_values.disconnect_threshold_time_s,
+  };
+  lap->services.connect.indication(frame->src_address, connection->connection_addr, &resp_qos, lap->priv);
+  return IRLAP_FRAME_HANDLED;
+
+fail_state:
+  lap->role = IRLAP_STATION_ROLE_NONE;
+  lap->state = IRLAP_STATION_MODE_NDM;
+fail_connection_alloc:
+  irlap_connection_free(connection);
+  return err;
+}
+
+int irlap_connect_handle_snrm_cmd(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf) {
+  union irlap_snrm_frame frame;
+  struct irlap_connection* connection;
+  int err;
+
+  if(len < sizeof(frame.data)) {
+    IRLAP_CONN_LOGW(&lap->connect, "Got invalid snrm cmd with len %zu < %zu", len, sizeof(frame.data));
+    return -EINVAL;
+  }
+
+  memcpy(&frame.data, data, sizeof(frame.data));
+  data += sizeof(frame.data);
+  len -= sizeof(frame.data);
+
+  if(frame.dst_address != irlap_get_address(lap)) {
+    IRLAP_CONN_LOGD(&lap->connect, "Ignoring snrm cmd for %08x", frame.dst_address);
+    return IRLAP_FRAME_NOT_HANDLED;
+  }
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  switch(lap->state) {
+    case IRLAP_STATION_MODE_NDM:
+      err = irlap_connect_handle_snrm_cmd_ndm(lap, &frame, data, len);
+      break;
+    case IRLAP_STATION_MODE_NRM:
+      connection = irlap_connection_get(lap, frame.connection_addr);
+      if(lap->role != IRLAP_STATION_ROLE_SECONDARY || !connection || connection->remote_address != frame.src_address) {
+        err = -IRLAP_ERR_STATION_STATE;
+        break;
+      }
+      // Frames the primary may hold already can't be recovered, start over with a new connection
+      if(irlap_data_has_unacked(&connection->data)) {
+        IRLAP_CONN_LOGW(&lap->connect, "Link reset with unacknowledged frames, closing connection");
+        irlap_connection_close(connection);
+        err = irlap_connect_handle_snrm_cmd_ndm(lap, &frame, data, len);
+        break;
+      }
+      err = reset_connection(connection, frame.src_address, data, len);
+      break;
+    case IRLAP_STATION_MODE_CONN:
+      // Still waiting for the upper layer
+      err = IRLAP_FRAME_HANDLED;
+      break;
+    default:
+      err = -IRLAP_ERR_STATION_STATE;
+  }
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  return err;
+}
+
 static int irlap_connect_handle_ua_resp_ssetup(struct irlap_connection* conn, uint8_t* data, size_t len, bool pf) {
   int err;
   struct irlap* lap = conn->lap;
@@ -148,7 +778,7 @@ static int irlap_connect_handle_ua_resp_ssetup(struct irlap_connection* conn, ui
 
   irlap_connection_set_default_negotiation_params(lap, &params);
   err = irlap_negotiation_update_params(&params, data, len);
-  if(err) {
+  if(err < 0) {
     IRLAP_CONN_LOGW(&lap->connect, "Failed to decode ua resp negotiation params: %d", err);
     return err;
   }
@@ -158,15 +788,10 @@ static int irlap_connect_handle_ua_resp_ssetup(struct irlap_connection* conn, ui
     IRLAP_CONN_LOGW(&lap->connect, "Failed to negotiate connection parameters: %d", err);
     return err;
   }
+  irlap_set_rx_data_size(lap, conn->local_negotiation_values.data_size);
 
   irlap_connection_stop_p_timer(conn);
 
-  err = irlap_connection_send_rr_cmd(conn, 0);
-  if(err) {
-    IRLAP_CONN_LOGE(&lap->connect, "Failed to send initial RR frame: %d", err);
-    return err;
-  }
-
   lap->role = IRLAP_STATION_ROLE_PRIMARY;
   lap->state = IRLAP_STATION_MODE_NRM;
   conn->connection_state = IRLAP_CONNECTION_STATE_RECV;
@@ -180,9 +805,10 @@ static int irlap_connect_handle_ua_resp_ssetup(struct irlap_connection* conn, ui
     lap->services.connect.confirm(conn->connection_addr, &resp_qos, lap->priv);
   }
 
-  err = irlap_connection_start_p_timer(conn, irlap_connection_p_timeout);
+  // First turn of the data phase, p timer starts once it has been sent
+  err = irlap_data_send_turn(conn);
   if(err) {
-    IRLAP_CONN_LOGE(&lap->connect, "Failed to start p timer: %d", err);
+    IRLAP_CONN_LOGE(&lap->connect, "Failed to send initial poll: %d", err);
     return err;
   }
 
@@ -198,8 +824,17 @@ int irlap_connect_handle_ua_resp(struct irlap* lap, struct irlap_connection* con
   irlap_lock_take_reentrant(lap, lap->state_lock);
   switch(lap->state) {
     case IRLAP_STATION_MODE_SSETUP:
+    case IRLAP_STATION_MODE_SETUP:
       err = irlap_connect_handle_ua_resp_ssetup(conn, data, len, pf);
       break;
+    case IRLAP_STATION_MODE_NRM:
+      if(conn->connection_state != IRLAP_CONNECTION_STATE_DISC) {
+        err = -IRLAP_ERR_STATION_STATE;
+        break;
+      }
+      fallback_reconnect(conn);
+      err = IRLAP_FRAME_HANDLED;
+      break;
     default:
       err = -IRLAP_ERR_STATION_STATE;
   }
@@ -208,6 +843,38 @@ int irlap_connect_handle_ua_resp(struct irlap* lap, struct irlap_connection* con
   return err;
 }
 
+// Primary takes the connection down, anything unacknowledged is lost
+int irlap_connect_handle_disc_cmd(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf) {
+  irlap_frame_hdr_t hdr = {
+    .control = IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_RESP_UA | IRLAP_RESP_FINAL,
+  };
+  int err;
+
+  if(!conn) {
+    IRLAP_CONN_LOGD(&lap->connect, "Ignoring disc cmd outside connection");
+    return -IRLAP_ERR_NO_CONNECTION;
+  }
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  if(lap->state != IRLAP_STATION_MODE_NRM || lap->role != IRLAP_STATION_ROLE_SECONDARY) {
+    err = -IRLAP_ERR_STATION_STATE;
+    goto out_state_locked;
+  }
+
+  // Baudrate is picked while queueing, the ua resp still goes out at the connection's speed
+  hdr.connection_address = IRLAP_FRAME_MAKE_ADDRESS_RESPONSE(conn->connection_addr);
+  err = irlap_tx_queue_frame_single(&lap->tx, &hdr, NULL, 0, NULL, NULL);
+  if(err) {
+    IRLAP_CONN_LOGW(&lap->connect, "Failed to queue ua resp to disc cmd: %d", err);
+  }
+  irlap_connection_close(conn);
+  irlap_set_baudrate_at_turnaround(lap, IRLAP_BAUDRATE_CONTENTION);
+  err = IRLAP_FRAME_HANDLED;
+
+out_state_locked:
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  return err;
+}
+
 static int irlap_connect_handle_dm_resp_ssetup(struct irlap_connection* conn) {
   struct irlap* lap = conn->lap;
   irlap_connection_stop_p_timer(conn);
@@ -228,8 +895,17 @@ int irlap_connect_handle_dm_resp(struct irlap* lap, struct irlap_connection* con
   irlap_lock_take_reentrant(lap, lap->state_lock);
   switch(lap->state) {
     case IRLAP_STATION_MODE_SSETUP:
+    case IRLAP_STATION_MODE_SETUP:
       err = irlap_connect_handle_dm_resp_ssetup(conn);
       break;
+    case IRLAP_STATION_MODE_NRM:
+      if(conn->connection_state != IRLAP_CONNECTION_STATE_DISC) {
+        err = -IRLAP_ERR_STATION_STATE;
+        break;
+      }
+      fallback_reconnect(conn);
+      err = IRLAP_FRAME_HANDLED;
+      break;
     default:
       err = -IRLAP_ERR_STATION_STATE;
   }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "irlap_defs.h"
@@ -24,12 +25,6 @@ struct irlap_connect_resp_qos {
   irlap_disconnect_threshold_t disconnect_threshold;  
 };
 
-struct irlap_connect {
-  struct irlap_connect_req_qos current_req_qos;
-  irlap_addr_t current_target_addr;
-  void* connect_lock;
-};
-
 union irlap_ua_frame {
   struct {
     irlap_addr_t src_address;
@@ -40,6 +35,22 @@ union irlap_ua_frame {
   uint8_t data_params[8 + IRLAP_NEGOTIATION_PARAMETERS_MAX_LEN];
 };
 
+// Number of SNRM cmds sent before a connect request is given up
+#define IRLAP_CONNECT_SNRM_RETRIES_MAX 3
+
+struct irlap_connect {
+  struct irlap_connect_req_qos current_req_qos;
+  irlap_addr_t current_target_addr;
+  void* connect_lock;
+  unsigned int snrm_retries;
+  // Built as soon as the snrm cmd arrives, sent again if the primary repeats it
+  union irlap_ua_frame ua_frame;
+  size_t ua_frame_len;
+  // Limits picked by the link quality fallback, on top of current_req_qos
+  irlap_addr_t fallback_addr;
+  struct irlap_connect_req_qos fallback_qos;
+};
+
 struct irlap_unacked_data {
   uint8_t _keep;
 };
@@ -61,6 +72,13 @@ struct irlap_service_disconnect {
 int irlap_connect_init(struct irlap_connect* conn);
 void irlap_connect_free(struct irlap_connect* conn);
 
+int irlap_connect_request(struct irlap_connect* conn, irlap_addr_t target_addr, struct irlap_connect_req_qos* qos, bool sniff);
+int irlap_connect_response(struct irlap_connect* conn, irlap_connection_addr_t hndl);
+int irlap_connect_renegotiate(struct irlap_connection* conn, bool step_up);
+int irlap_connect_reset(struct irlap_connection* conn);
+
+int irlap_connect_handle_snrm_cmd(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf);
 int irlap_connect_handle_ua_resp(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf);
 int irlap_connect_handle_dm_resp(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf);
+int irlap_connect_handle_disc_cmd(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf);
 int irlap_connect_handle_sniff_xid_req_sconn(struct irlap* lap, irlap_addr_t addr);
@@ -23,77 +23,83 @@ void irlap_connection_set_default_negotiation_params(struct irlap* lap, irlap_ne
     .min_turn_around_time_us = 0,
     .disconnect_threshold_time_s = 30
   };
-	irlap_negotiation_translate_values_to_params(params, &values, irlap_get_supported_baudrates(lap));
-}
-
-struct irlap_connection* irlap_connection_get(struct irlap* lap, irlap_connection_addr_t connection_addr) {
-  struct irlap_connection* conn = NULL;
-  irlap_discovery_log_list_t* cursor;
+  int err;
 
   irlap_lock_take_reentrant(lap, lap->connection_lock);
-  LIST_FOR_EACH(cursor, &lap->connections) {
-    struct irlap_connection* entry = LIST_GET_ENTRY(cursor, struct irlap_connection, list);
-    if(IRLAP_CONNECTION_ADDRESS_MASK_CMD_BIT(entry->connection_addr) == IRLAP_CONNECTION_ADDRESS_MASK_CMD_BIT(connection_addr)) {
-      conn = entry;
-      break;
-    }
+  err = irlap_negotiation_context_update(&lap->negotiation, &values, irlap_get_supported_baudrates(lap));
+  if(err) {
+    IRHAL_LOGE(lap->phy->hal, "Failed to build default negotiation parameters: %d", err);
   }
-
+  *params = lap->negotiation.params;
   irlap_lock_put_reentrant(lap, lap->connection_lock);
-  return conn;
 }
 
-int irlap_connection_alloc(struct irlap* lap, irlap_addr_t remote_addr, struct irlap_connection** retval) {
+// Caller must hold the connection lock
+struct irlap_connection* irlap_connection_get(struct irlap* lap, irlap_connection_addr_t connection_addr) {
+  return lap->connection_table[IRLAP_CONNECTION_ADDRESS_TO_INDEX(connection_addr)];
+}
+
+// Picks a random free connection address unless connection_addr is given
+static int irlap_connection_alloc_(struct irlap* lap, irlap_addr_t remote_addr, irlap_connection_addr_t connection_addr, struct irlap_connection** retval) {
   int err;
-  irlap_connection_addr_t i;
-  irlap_connection_addr_t connection_addr = 0;
-  uint8_t num_free_addrs = 0;
+  size_t num_free_addrs;
+  ssize_t connection_idx;
   uint8_t connection_addr_idx;
-  struct irlap_connection* conn = calloc(1, sizeof(struct irlap_connection));
+  struct irlap_connection* conn = objpool_get(&lap->pools.connections);
   if(!conn) {
-    err = -ENOMEM;
+    err = -ENOBUFS;
     goto fail;
   }
+  memset(conn, 0, sizeof(*conn));
   conn->lap = lap;
   conn->remote_address = remote_addr;
+  conn->p_timer = IRHAL_TIMER_INVALID;
+  conn->f_timer = IRHAL_TIMER_INVALID;
+  irlap_connection_set_default_negotiation_params(lap, &conn->local_negotiation_params);
+  irlap_data_init(&conn->data, lap->selective_reject);
+  irlap_poll_init(&conn->poll);
   err = irlap_lock_alloc_reentrant(lap, &conn->state_lock);
   if(err) {
     goto fail_connection_alloc;
   }
   irlap_lock_take_reentrant(lap, lap->connection_lock);
 
-  // Calculate number of free addresses
-  for(i = IRLAP_CONNECTION_ADDRESS_MIN; i < IRLAP_CONNECTION_ADDRESS_MAX; i++) {
-    if(!irlap_connection_get(lap, i)) {
-      num_free_addrs++;
+  if(connection_addr != IRLAP_CONNECTION_ADDRESS_NULL) {
+    connection_idx = IRLAP_CONNECTION_ADDRESS_TO_INDEX(connection_addr);
+    if(connection_idx >= IRLAP_CONNECTION_INDEX_MAX || !bitmap_test(lap->connection_addr_free, connection_idx)) {
+      IRLAP_CONNECTION_LOGW(conn, "Failed to set up lap connection, connection address %u not available", connection_addr);
+      err = -IRLAP_ERR_NO_CONNECTION_ADDRESS_AVAILABLE;
+      goto fail_connections_locked;
+    }
+  } else {
+    num_free_addrs = bitmap_weight(lap->connection_addr_free, ARRAY_LEN(lap->connection_addr_free));
+    IRLAP_CONNECTION_LOGD(conn, "Have %zu free connection numbers", num_free_addrs);
+    if(num_free_addrs == 0) {
+      IRLAP_CONNECTION_LOGW(conn, "Failed to set up lap connection, no free connection addresses available");
+      err = -IRLAP_ERR_NO_CONNECTION_ADDRESS_AVAILABLE;
+      goto fail_connections_locked;
     }
-  }
-
-  IRLAP_CONNECTION_LOGD(conn, "Have %u free connection numbers", num_free_addrs);
-  if(num_free_addrs == 0) {
-    IRLAP_CONNECTION_LOGW(conn, "Failed to set up lap connection, no free connection addresses available");
-    err = -IRLAP_ERR_NO_CONNECTION_ADDRESS_AVAILABLE;
-    goto fail_connections_locked;
-  }
 
-  err = irlap_random_u8(lap, &connection_addr_idx, 0, num_free_addrs);
-  if(err) {
-    IRLAP_CONNECTION_LOGE(conn, "Failed to get random connection number index");
-    goto fail_connections_locked;
-  }
+    err = irlap_random_u8(lap, &connection_addr_idx, 0, num_free_addrs);
+    if(err) {
+      IRLAP_CONNECTION_LOGE(conn, "Failed to get random connection number index");
+      goto fail_connections_locked;
+    }
 
-  // Get n-th free address
-  for(i = IRLAP_CONNECTION_ADDRESS_MIN; i < IRLAP_CONNECTION_ADDRESS_MAX; i++) {
-    if(!irlap_connection_get(lap, i)) {
-      if(connection_addr_idx-- == 0) {
-        connection_addr = i;
-      }
+    // Get n-th free address
+    connection_idx = bitmap_select(lap->connection_addr_free, ARRAY_LEN(lap->connection_addr_free), connection_addr_idx);
+    if(connection_idx < 0) {
+      IRLAP_CONNECTION_LOGE(conn, "BUG: free connection address %u not found in bitmap", connection_addr_idx);
+      err = -IRLAP_ERR_NO_CONNECTION_ADDRESS_AVAILABLE;
+      goto fail_connections_locked;
     }
   }
 
-  IRLAP_CONNECTION_LOGD(conn, "Got connection address %u", connection_addr);
+  conn->connection_addr = IRLAP_CONNECTION_INDEX_TO_ADDRESS(connection_idx);
+  IRLAP_CONNECTION_LOGD(conn, "Got connection address %u", conn->connection_addr);
 
-  conn->connection_addr = connection_addr;
+  bitmap_clear(lap->connection_addr_free, connection_idx);
+  lap->connection_table[connection_idx] = conn;
   LIST_APPEND(&conn->list, &lap->connections);
 
   irlap_lock_put_reentrant(lap, lap->connection_lock);
@@ -102,37 +108,95 @@ int irlap_connection_alloc(struct irlap* lap, irlap_addr_t remote_addr, struct i
 
 fail_connections_locked:
   irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_free_reentrant(lap, conn->state_lock);
 fail_connection_alloc:
-  free(conn);
+  objpool_put(&lap->pools.connections, conn);
 fail:
   return err;
 }
 
+int irlap_connection_alloc(struct irlap* lap, irlap_addr_t remote_addr, struct irlap_connection** retval) {
+  return irlap_connection_alloc_(lap, remote_addr, IRLAP_CONNECTION_ADDRESS_NULL, retval);
+}
+
+// Secondaries use the connection address chosen by the primary
+int irlap_connection_alloc_addr(struct irlap* lap, irlap_addr_t remote_addr, irlap_connection_addr_t connection_addr, struct irlap_connection** retval) {
+  if(IRLAP_CONNECTION_ADDRESS_MASK_CMD_BIT(connection_addr) == IRLAP_CONNECTION_ADDRESS_NULL) {
+    return -IRLAP_ERR_ADDRESS;
+  }
+  return irlap_connection_alloc_(lap, remote_addr, IRLAP_CONNECTION_ADDRESS_MASK_CMD_BIT(connection_addr), retval);
+}
+
 void irlap_connection_free(struct irlap_connection* conn) {
   struct irlap* lap = conn->lap;
+  unsigned int connection_idx = IRLAP_CONNECTION_ADDRESS_TO_INDEX(conn->connection_addr);
   irlap_lock_take_reentrant(lap, lap->connection_lock);
   LIST_DELETE(&conn->list);
+  lap->connection_table[connection_idx] = NULL;
+  bitmap_set(lap->connection_addr_free, connection_idx);
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  irlap_poll_cancel(conn);
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+  irlap_data_free(conn);
+  if(LIST_IS_EMPTY(&lap->connections)) {
+    irlap_set_rx_data_size(lap, IRLAP_RX_DATA_SIZE_CONTENTION);
+  }
   irlap_lock_free_reentrant(lap, conn->state_lock);
-  free(conn);
+  objpool_put(&lap->pools.connections, conn);
   irlap_lock_put_reentrant(lap, lap->connection_lock);
 }
 
+static unsigned int irlap_connection_get_max_turn_around_time(struct irlap_connection* conn) {
+  if(IRLAP_CONNECTION_IS_NEGOTIATED(conn) && conn->local_negotiation_values.max_turn_around_time_ms) {
+    return conn->local_negotiation_values.max_turn_around_time_ms;
+  }
+  return IRLAP_P_TIMEOUT_MAX;
+}
+
+// Smoothed response time plus four mean deviations, never less than it takes to receive one full frame
+static unsigned int irlap_connection_get_p_timeout(struct irlap_connection* conn) {
+  struct irlap_connection_rtt* rtt = &conn->rtt;
+  unsigned int timeout_max = irlap_connection_get_max_turn_around_time(conn);
+  uint32_t baudrate = irlap_connection_get_baudrate(conn);
+  uint64_t timeout_us;
+  uint64_t frame_us;
+
+  if(!rtt->valid || conn->connection_state != IRLAP_CONNECTION_STATE_RECV || conn->data.retry_count) {
+    return timeout_max;
+  }
+
+  // Async wrapping takes 10 bit times per byte, at worst every byte is escaped
+  frame_us = (uint64_t)conn->local_negotiation_values.data_size * 2 * 10 * 1000000 / baudrate;
+  timeout_us = (uint64_t)rtt->srtt_us + 4 * (uint64_t)rtt->rttvar_us;
+  timeout_us = max(timeout_us, frame_us + conn->remote_negotiation_values.min_turn_around_time_us);
+  return min((unsigned int)(timeout_us / 1000) + IRLAP_CONNECTION_P_TIMEOUT_SLACK_MS, timeout_max);
+}
+
+static int irlap_connection_set_p_timer(struct irlap_connection* conn, unsigned int timeout, irhal_timer_cb cb) {
+  int err = irlap_set_timer(conn->lap, timeout, cb, conn);
+  if(err < 0) {
+    return err;
+  }
+  if(conn->p_timer >= 0) {
+    irlap_clear_timer(conn->lap, conn->p_timer);
+  }
+  conn->p_timer = err;
+  conn->p_timer_cb = cb;
+  return 0;
+}
+
 int irlap_connection_start_p_timer(struct irlap_connection* conn, irhal_timer_cb cb) {
-  unsigned int timeout = IRLAP_P_TIMEOUT_MAX;
   int err;
   irlap_lock_take_reentrant(conn->lap, conn->state_lock);
-  if(IRLAP_CONNECTION_IS_NEGOTIATED(conn)) {
-    timeout = conn->local_negotiation_values.max_turn_around_time_ms;
+  err = irlap_connection_set_p_timer(conn, irlap_connection_get_p_timeout(conn), cb);
+  if(err) {
+    goto fail_locked;
+  }
+  // Answers to repeated polls can't be told apart, only time first attempts
+  conn->rtt.pending = conn->connection_state == IRLAP_CONNECTION_STATE_RECV && !conn->data.retry_count;
+  if(conn->rtt.pending) {
+    irhal_now(conn->lap->phy->hal, &conn->rtt.turn_sent);
   }
-  err = irlap_set_timer(conn->lap, timeout, cb, conn);
-	if(err < 0) {
-		goto fail_locked;
-	}
-	if(conn->p_timer >= 0) {
-		irlap_clear_timer(conn->lap, conn->p_timer);
-	}
-	conn->p_timer = err;
-	err = 0;
 
 fail_locked:
   irlap_lock_put_reentrant(conn->lap, conn->state_lock);
@@ -145,40 +209,146 @@ void irlap_connection_stop_p_timer(struct irlap_connection* conn) {
 		irlap_clear_timer(conn->lap, conn->p_timer);
     conn->p_timer = -1;
 	}
+  conn->rtt.pending = false;
   irlap_lock_put_reentrant(conn->lap, conn->state_lock);
 }
 
-int irlap_connection_send_snrm_cmd(struct irlap_connection* conn) {
+// First frame of the remote's turn arrived. The remote holds the link now and may keep it for
+// the full max turn around time, unless this frame already handed the turn back
+void irlap_connection_rtt_sample(struct irlap_connection* conn, bool final) {
+  struct irlap_connection_rtt* rtt = &conn->rtt;
+  time_ns_t now;
+  uint32_t sample_us;
+  uint32_t delta_us;
+  int err;
+
+  irlap_lock_take_reentrant(conn->lap, conn->state_lock);
+  if(!rtt->pending) {
+    goto out_locked;
+  }
+  rtt->pending = false;
+
+  irhal_now(conn->lap->phy->hal, &now);
+  time_sub(&now, &rtt->turn_sent);
+  sample_us = (uint32_t)min(time_to_ns(&now) / 1000, (uint64_t)UINT32_MAX);
+  if(!rtt->valid) {
+    rtt->srtt_us = sample_us;
+    rtt->rttvar_us = sample_us / 2;
+    rtt->valid = true;
+  } else {
+    delta_us = sample_us > rtt->srtt_us ? sample_us - rtt->srtt_us : rtt->srtt_us - sample_us;
+    rtt->rttvar_us = rtt->rttvar_us - (rtt->rttvar_us >> IRLAP_CONNECTION_RTTVAR_SHIFT) + (delta_us >> IRLAP_CONNECTION_RTTVAR_SHIFT);
+    rtt->srtt_us = rtt->srtt_us - (rtt->srtt_us >> IRLAP_CONNECTION_RTT_SHIFT) + (sample_us >> IRLAP_CONNECTION_RTT_SHIFT);
+  }
+  IRLAP_CONNECTION_LOGV(conn, "Response time %u us, smoothed %u us, deviation %u us", sample_us, rtt->srtt_us, rtt->rttvar_us);
+
+  if(!final && conn->p_timer >= 0) {
+    err = irlap_connection_set_p_timer(conn, irlap_connection_get_max_turn_around_time(conn), conn->p_timer_cb);
+    if(err) {
+      IRLAP_CONNECTION_LOGE(conn, "Failed to restart p timer: %d", err);
+    }
+  }
+
+out_locked:
+  irlap_lock_put_reentrant(conn->lap, conn->state_lock);
+}
+
+// Wait for the primary to poll us, it must do so within the negotiated max turn around time
+int irlap_connection_start_f_timer(struct irlap_connection* conn, irhal_timer_cb cb) {
+  unsigned int timeout = IRLAP_F_TIMEOUT_MAX;
+  int err;
+  irlap_lock_take_reentrant(conn->lap, conn->state_lock);
+  if(IRLAP_CONNECTION_IS_NEGOTIATED(conn)) {
+    timeout = conn->local_negotiation_values.max_turn_around_time_ms;
+  }
+  err = irlap_set_timer(conn->lap, timeout, cb, conn);
+  if(err < 0) {
+    goto fail_locked;
+  }
+  if(conn->f_timer >= 0) {
+    irlap_clear_timer(conn->lap, conn->f_timer);
+  }
+  conn->f_timer = err;
+  err = 0;
+
+fail_locked:
+  irlap_lock_put_reentrant(conn->lap, conn->state_lock);
+  return err;
+}
+
+void irlap_connection_stop_f_timer(struct irlap_connection* conn) {
+  irlap_lock_take_reentrant(conn->lap, conn->state_lock);
+  if(conn->f_timer >= 0) {
+    irlap_clear_timer(conn->lap, conn->f_timer);
+    conn->f_timer = IRHAL_TIMER_INVALID;
+  }
+  irlap_lock_put_reentrant(conn->lap, conn->state_lock);
+}
+
+// Tear down a connection the remote stopped answering on, there is nobody left to tell
+void irlap_connection_close(struct irlap_connection* conn) {
   struct irlap* lap = conn->lap;
-	ssize_t data_len;
-	irlap_negotiation_params_t negotiation_params;
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  IRLAP_CONNECTION_LOGI(conn, "Closing connection %u", conn->connection_addr);
+  irlap_connection_stop_p_timer(conn);
+  irlap_connection_stop_f_timer(conn);
+  if(lap->services.disconnect.indication) {
+    lap->services.disconnect.indication(conn->connection_addr, NULL, lap->priv);
+  }
+  irlap_connection_free(conn);
+  if(LIST_IS_EMPTY(&lap->connections)) {
+    lap->state = IRLAP_STATION_MODE_NDM;
+    lap->role = IRLAP_STATION_ROLE_NONE;
+  }
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+static ssize_t irlap_connection_build_snrm_cmd(struct irlap_connection* conn, union irlap_snrm_frame* frame) {
+  struct irlap* lap = conn->lap;
+  ssize_t data_len;
+
+  frame->src_address = irlap_get_address(lap);
+  frame->dst_address = conn->remote_address;
+  frame->connection_addr = conn->connection_addr;
+
+  data_len = irlap_negotiation_context_populate_params(&lap->negotiation, frame->negotiation_params, IRLAP_NEGOTIATION_PARAMETERS_MAX_LEN, &conn->local_negotiation_params);
+  if(data_len < 0) {
+    IRLAP_CONNECTION_LOGE(conn, "Failed to write connection parameters to snrm cmd frame");
+    return data_len;
+  }
+  return sizeof(frame->data) + data_len;
+}
+
+int irlap_connection_send_snrm_cmd(struct irlap_connection* conn) {
+  ssize_t frame_len;
   union irlap_snrm_frame frame;
   irlap_frame_hdr_t hdr = {
     .connection_address = IRLAP_FRAME_MAKE_ADDRESS_COMMAND(IRLAP_CONNECTION_ADDRESS_BCAST),
     .control = IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_SNRM | IRLAP_CMD_POLL,
   };
 
-  frame.src_address = irlap_get_address(lap);
-  frame.dst_address = conn->remote_address;
-  frame.connection_addr = conn->connection_addr;
-
-  irlap_connection_set_default_negotiation_params(lap, &negotiation_params);
-	data_len = irlap_negotiation_populate_params(frame.negotiation_params, IRLAP_NEGOTIATION_PARAMETERS_MAX_LEN, &negotiation_params);
-	if(data_len < 0) {
-		IRLAP_CONNECTION_LOGE(conn, "Failed to write connection parameters to snrm cmd frame");
-		return (int)data_len;
-	}
-	return irlap_send_frame_single(lap, &hdr, frame.data_params, sizeof(frame.data) + data_len);
+  frame_len = irlap_connection_build_snrm_cmd(conn, &frame);
+  if(frame_len < 0) {
+    return (int)frame_len;
+  }
+  return irlap_send_frame_single(conn->lap, &hdr, frame.data_params, frame_len);
 }
 
-#define SUPERVISORY_NR(nr) (((nr) << 5) & IRLAP_SUPERVISORY_NR_MASK)
-
-int irlap_connection_send_rr_cmd(struct irlap_connection* conn, uint8_t nr) {
+int irlap_connection_queue_snrm_cmd(struct irlap_connection* conn, irlap_tx_complete_f complete, void* priv) {
+  ssize_t frame_len;
+  union irlap_snrm_frame frame;
   irlap_frame_hdr_t hdr = {
-    .connection_address = IRLAP_FRAME_MAKE_ADDRESS_COMMAND(conn->connection_addr),
-    .control = IRLAP_FRAME_FORMAT_SUPERVISORY | IRLAP_CMD_RR | IRLAP_CMD_POLL | SUPERVISORY_NR(nr),
+    .connection_address = IRLAP_FRAME_MAKE_ADDRESS_COMMAND(IRLAP_CONNECTION_ADDRESS_BCAST),
+    .control = IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_SNRM | IRLAP_CMD_POLL,
   };
-	return irlap_send_frame_single(conn->lap, &hdr, NULL, 0);
+
+  frame_len = irlap_connection_build_snrm_cmd(conn, &frame);
+  if(frame_len < 0) {
+    return (int)frame_len;
+  }
+  return irlap_tx_queue_frame_single(&conn->lap->tx, &hdr, frame.data_params, frame_len, complete, priv);
 }
 
 uint32_t irlap_connection_get_baudrate(struct irlap_connection* conn) {
@@ -194,7 +364,3 @@ uint8_t irlap_connection_get_num_additional_bofs(struct irlap_connection* conn)
   }
   return IRLAP_FRAME_ADDITIONAL_BOF_CONTENTION;
 }
-
-void irlap_connection_p_timeout(void* priv) {
-
-}
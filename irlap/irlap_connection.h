@@ -1,10 +1,32 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "irlap_defs.h"
+#include "irlap_data.h"
 #include "irlap_negotiation.h"
+#include "irlap_poll.h"
+#include "irlap_tx.h"
 #include "../irhal/irhal.h"
+#include "../util/time.h"
+
+// Gain of the smoothed response time and its mean deviation, as right shifts
+#define IRLAP_CONNECTION_RTT_SHIFT    3
+#define IRLAP_CONNECTION_RTTVAR_SHIFT 2
+// Slack on top of the adaptive p timeout, covers timer granularity
+#ifndef IRLAP_CONNECTION_P_TIMEOUT_SLACK_MS
+#define IRLAP_CONNECTION_P_TIMEOUT_SLACK_MS 10
+#endif
+
+// Time from handing over the turn to the first frame of the remote's answer
+struct irlap_connection_rtt {
+  time_ns_t turn_sent;
+  bool pending;
+  bool valid;
+  uint32_t srtt_us;
+  uint32_t rttvar_us;
+};
 
 struct irlap_connection {
   irlap_connection_list_t list;
@@ -16,12 +38,14 @@ struct irlap_connection {
   irlap_negotiation_values_t local_negotiation_values;
   irlap_negotiation_values_t remote_negotiation_values;
   int p_timer;
+  irhal_timer_cb p_timer_cb;
   int f_timer;
+  struct irlap_connection_rtt rtt;
   irlap_addr_t remote_address;
+  struct irlap_data data;
+  struct irlap_poll_state poll;
 };
 
-#define IRLAP_NEGOTIATION_PARAMETERS_MAX_LEN 22
-
 union irlap_snrm_frame {
   struct {
     irlap_addr_t            src_address;
@@ -36,11 +60,15 @@ union irlap_snrm_frame {
 void irlap_connection_set_default_negotiation_params(struct irlap* lap, irlap_negotiation_params_t* params);
 struct irlap_connection* irlap_connection_get(struct irlap* lap, irlap_connection_addr_t connection_addr);
 int irlap_connection_alloc(struct irlap* lap, irlap_addr_t remote_addr, struct irlap_connection** retval);
+int irlap_connection_alloc_addr(struct irlap* lap, irlap_addr_t remote_addr, irlap_connection_addr_t connection_addr, struct irlap_connection** retval);
 void irlap_connection_free(struct irlap_connection* conn);
+void irlap_connection_close(struct irlap_connection* conn);
 int irlap_connection_start_p_timer(struct irlap_connection* conn, irhal_timer_cb cb);
 void irlap_connection_stop_p_timer(struct irlap_connection* conn);
+void irlap_connection_rtt_sample(struct irlap_connection* conn, bool final);
+int irlap_connection_start_f_timer(struct irlap_connection* conn, irhal_timer_cb cb);
+void irlap_connection_stop_f_timer(struct irlap_connection* conn);
 int irlap_connection_send_snrm_cmd(struct irlap_connection* conn);
-int irlap_connection_send_rr_cmd(struct irlap_connection* conn, uint8_t nr);
+int irlap_connection_queue_snrm_cmd(struct irlap_connection* conn, irlap_tx_complete_f complete, void* priv);
 uint32_t irlap_connection_get_baudrate(struct irlap_connection* conn);
 uint8_t irlap_connection_get_num_additional_bofs(struct irlap_connection* conn);
-void irlap_connection_p_timeout(void* priv);
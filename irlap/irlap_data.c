@@ -0,0 +1,1004 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "irlap_data.h"
+#include "irlap.h"
+#include "irlap_connection.h"
+
+#define LOCAL_TAG "IRDA LAP DATA"
+
+#define IRLAP_DATA_LOGV(conn, fmt, ...) IRHAL_LOGV((conn)->lap->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_DATA_LOGD(conn, fmt, ...) IRHAL_LOGD((conn)->lap->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_DATA_LOGI(conn, fmt, ...) IRHAL_LOGI((conn)->lap->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_DATA_LOGW(conn, fmt, ...) IRHAL_LOGW((conn)->lap->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_DATA_LOGE(conn, fmt, ...) IRHAL_LOGE((conn)->lap->phy->hal, fmt, ##__VA_ARGS__)
+
+void irlap_data_init(struct irlap_data* idata, bool selective_reject) {
+  unsigned int i;
+
+  memset(idata, 0, sizeof(*idata));
+  for(i = 0; i < IRLAP_DATA_PRIORITY_NUM; i++) {
+    INIT_LIST_HEAD(idata->tx_queues[i]);
+  }
+  INIT_LIST_HEAD(idata->ui_queue);
+  idata->selective_reject = selective_reject;
+}
+
+// Drops the upper layer buffer reference along with the frame
+static void irlap_data_frame_release(struct irlap_data_buffer* storage) {
+  struct irlap_data_frame* frame = container_of(storage, struct irlap_data_frame, storage);
+  if(frame->buffer) {
+    irlap_data_buffer_put(frame->buffer);
+  }
+  objpool_put(frame->pool, frame);
+}
+
+static struct irlap_data_frame* irlap_data_frame_get(struct irlap* lap) {
+  struct irlap_data_frame* frame = objpool_get(&lap->pools.data_frames);
+  if(!frame) {
+    return NULL;
+  }
+  irlap_data_buffer_init(&frame->storage, frame->data, sizeof(frame->data), irlap_data_frame_release);
+  frame->pool = &lap->pools.data_frames;
+  frame->buffer = NULL;
+  return frame;
+}
+
+// Frames still queued for transmission are released once they have been sent
+static void irlap_data_frame_put(struct irlap* lap, struct irlap_data_frame* frame) {
+  irlap_data_buffer_put(&frame->storage);
+}
+
+static void irlap_data_put_window(struct irlap* lap, struct irlap_data_frame** window) {
+  unsigned int i;
+
+  for(i = 0; i < IRLAP_DATA_SEQ_MODULUS; i++) {
+    if(window[i]) {
+      irlap_data_frame_put(lap, window[i]);
+      window[i] = NULL;
+    }
+  }
+}
+
+static void irlap_data_put_queue(struct irlap* lap, struct list_head* queue) {
+  struct list_head *cursor, *next;
+
+  LIST_FOR_EACH_SAFE(cursor, next, queue) {
+    struct irlap_data_frame* frame = LIST_GET_ENTRY(cursor, struct irlap_data_frame, list);
+    LIST_DELETE(&frame->list);
+    irlap_data_frame_put(lap, frame);
+  }
+}
+
+// Release all queued and unacknowledged frames
+void irlap_data_free(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+  struct irlap_data* idata = &conn->data;
+  unsigned int i;
+
+  for(i = 0; i < IRLAP_DATA_PRIORITY_NUM; i++) {
+    irlap_data_put_queue(lap, &idata->tx_queues[i]);
+  }
+  irlap_data_put_queue(lap, &idata->ui_queue);
+  idata->ui_queued = 0;
+
+  irlap_data_put_window(lap, idata->tx_window);
+  irlap_data_put_window(lap, idata->rx_window);
+}
+
+// Start over after a link reset. Unacknowledged frames are dropped, the remote may hold them
+// already and sending them again would duplicate them. Frames never sent stay queued.
+// Returns the number of frames dropped
+unsigned int irlap_data_reset(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+  struct irlap_data* idata = &conn->data;
+  unsigned int dropped = 0;
+  unsigned int i;
+
+  for(i = 0; i < IRLAP_DATA_SEQ_MODULUS; i++) {
+    if(idata->tx_window[i]) {
+      dropped++;
+    }
+  }
+  irlap_data_put_window(lap, idata->tx_window);
+  irlap_data_put_window(lap, idata->rx_window);
+
+  idata->vs = 0;
+  idata->vr = 0;
+  idata->va = 0;
+  idata->remote_busy = false;
+  idata->reject_pending = false;
+  idata->selective_reject = lap->selective_reject;
+  idata->srej_requested = 0;
+  idata->srej_sent = 0;
+  idata->rx_turn = 0;
+  idata->rx_unitdata = false;
+  idata->srej_ignored = 0;
+  idata->retry_count = 0;
+  idata->turn_error = false;
+  idata->error_rate = 0;
+  idata->error_samples = 0;
+  idata->clean_turns = 0;
+  idata->frame_rejected = false;
+  return dropped;
+}
+
+static bool irlap_data_is_primary(struct irlap* lap) {
+  return lap->role == IRLAP_STATION_ROLE_PRIMARY;
+}
+
+static uint8_t irlap_data_get_address(struct irlap_connection* conn) {
+  if(irlap_data_is_primary(conn->lap)) {
+    return IRLAP_FRAME_MAKE_ADDRESS_COMMAND(conn->connection_addr);
+  }
+  return IRLAP_FRAME_MAKE_ADDRESS_RESPONSE(conn->connection_addr);
+}
+
+// Number of consecutive timeouts tolerated before the link is considered lost
+static unsigned int irlap_data_get_retry_limit(struct irlap_connection* conn) {
+  unsigned int timeout_ms = conn->local_negotiation_values.max_turn_around_time_ms;
+  unsigned int limit;
+
+  if(!timeout_ms) {
+    timeout_ms = IRLAP_P_TIMEOUT_MAX;
+  }
+  limit = conn->local_negotiation_values.disconnect_threshold_time_s * 1000 / timeout_ms;
+  return max(limit, IRLAP_DATA_RETRY_LIMIT_MIN);
+}
+
+static int irlap_data_enqueue(struct irlap* lap, irlap_connection_addr_t hndl, uint8_t* data, size_t len, struct irlap_data_buffer* buffer, irlap_data_priority_t priority) {
+  struct irlap_connection* conn;
+  struct irlap_data_frame* frame;
+  irlap_frame_hdr_t hdr;
+  ssize_t wrapped_len;
+  int err = 0;
+
+  if(priority >= IRLAP_DATA_PRIORITY_NUM) {
+    return -EINVAL;
+  }
+
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, hndl);
+  if(!conn || !IRLAP_CONNECTION_IS_NEGOTIATED(conn)) {
+    err = -IRLAP_ERR_NO_CONNECTION;
+    goto fail_connections_locked;
+  }
+
+  if(len > conn->remote_negotiation_values.data_size) {
+    IRLAP_DATA_LOGW(conn, "Data request with %zu bytes exceeds negotiated data size of %u bytes", len, conn->remote_negotiation_values.data_size);
+    err = -IRLAP_ERR_DATA_TOO_LONG;
+    goto fail_connections_locked;
+  }
+
+  frame = irlap_data_frame_get(lap);
+  if(!frame) {
+    IRLAP_DATA_LOGD(conn, "Data frame pool exhausted");
+    err = -ENOBUFS;
+    goto fail_connections_locked;
+  }
+
+  // Stuff payload only once, Ns and Nr are patched in on every transmission.
+  // Upper layer buffers are referenced in place unless they need stuffing
+  hdr.connection_address = irlap_data_get_address(conn);
+  hdr.control = IRLAP_FRAME_FORMAT_INFORMATION;
+  wrapped_len = irlap_wrapper_prewrap(IRLAP_FRAME_WRAPPER_ASYNC, &frame->wrapped, frame->data, sizeof(frame->data), &hdr, data, len, !!buffer);
+  if(wrapped_len < 0) {
+    IRLAP_DATA_LOGE(conn, "Failed to wrap data frame: %zd", wrapped_len);
+    err = wrapped_len;
+    goto fail_frame;
+  }
+  frame->len = len;
+  frame->buffer = buffer;
+  if(buffer) {
+    irlap_data_buffer_get(buffer);
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  LIST_APPEND_TAIL(&frame->list, &conn->data.tx_queues[priority]);
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+  irlap_poll_kick(lap);
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  return 0;
+
+fail_frame:
+  irlap_data_frame_put(lap, frame);
+fail_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  return err;
+}
+
+// Payload is copied, queued as bulk data
+int irlap_data_request(struct irlap* lap, irlap_connection_addr_t hndl, const uint8_t* data, size_t len) {
+  return irlap_data_enqueue(lap, hndl, (uint8_t*)data, len, NULL, IRLAP_DATA_PRIORITY_BULK);
+}
+
+// Payload is referenced until acknowledged, the caller keeps its own reference
+int irlap_data_request_buffer(struct irlap* lap, irlap_connection_addr_t hndl, struct irlap_data_buffer* buf, irlap_data_priority_t priority) {
+  return irlap_data_enqueue(lap, hndl, buf->data, buf->len, buf, priority);
+}
+
+// Unnumbered data sent on the next turn without acknowledgement. Samples still waiting when the queue
+// is full are stale, the oldest one is dropped instead of failing the request
+int irlap_data_unitdata_request(struct irlap* lap, irlap_connection_addr_t hndl, const uint8_t* data, size_t len) {
+  struct irlap_connection* conn;
+  struct irlap_data_frame* frame;
+  irlap_frame_hdr_t hdr;
+  ssize_t wrapped_len;
+  int err = 0;
+
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, hndl);
+  if(!conn || !IRLAP_CONNECTION_IS_NEGOTIATED(conn)) {
+    err = -IRLAP_ERR_NO_CONNECTION;
+    goto fail_connections_locked;
+  }
+
+  if(len > conn->remote_negotiation_values.data_size) {
+    IRLAP_DATA_LOGW(conn, "Unitdata request with %zu bytes exceeds negotiated data size of %u bytes", len, conn->remote_negotiation_values.data_size);
+    err = -IRLAP_ERR_UNITDATA_TOO_LONG;
+    goto fail_connections_locked;
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  if(conn->data.ui_queued >= IRLAP_DATA_UI_QUEUE_MAX) {
+    frame = LIST_GET_ENTRY(conn->data.ui_queue.next, struct irlap_data_frame, list);
+    IRLAP_DATA_LOGD(conn, "Unitdata queue full, dropping oldest frame");
+    LIST_DELETE(&frame->list);
+    conn->data.ui_queued--;
+  } else {
+    frame = irlap_data_frame_get(lap);
+    if(!frame) {
+      IRLAP_DATA_LOGD(conn, "Data frame pool exhausted");
+      err = -ENOBUFS;
+      goto fail_state_locked;
+    }
+  }
+
+  hdr.connection_address = irlap_data_get_address(conn);
+  hdr.control = IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_UI;
+  wrapped_len = irlap_wrapper_prewrap(IRLAP_FRAME_WRAPPER_ASYNC, &frame->wrapped, frame->data, sizeof(frame->data), &hdr, (uint8_t*)data, len, false);
+  if(wrapped_len < 0) {
+    IRLAP_DATA_LOGE(conn, "Failed to wrap unitdata frame: %zd", wrapped_len);
+    err = wrapped_len;
+    goto fail_frame;
+  }
+  frame->len = len;
+  frame->buffer = NULL;
+  LIST_APPEND_TAIL(&frame->list, &conn->data.ui_queue);
+  conn->data.ui_queued++;
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+  irlap_poll_kick(lap);
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  return 0;
+
+fail_frame:
+  irlap_data_frame_put(lap, frame);
+fail_state_locked:
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+fail_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  return err;
+}
+
+// Enable receive flow control, high == 0 disables it. Upper layer must release every indicated frame
+int irlap_data_set_rx_watermarks(struct irlap* lap, irlap_connection_addr_t hndl, unsigned int high, unsigned int low) {
+  struct irlap_connection* conn;
+  int err = 0;
+
+  if(high && low >= high) {
+    return -EINVAL;
+  }
+
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, hndl);
+  if(!conn) {
+    err = -IRLAP_ERR_NO_CONNECTION;
+    goto out_connections_locked;
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  conn->data.rx_queue_high = high;
+  conn->data.rx_queue_low = low;
+  conn->data.rx_queued = 0;
+  conn->data.local_busy = false;
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+
+out_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  return err;
+}
+
+// Upper layer consumed num_frames indicated frames, the next turn answers with RR again once below the low watermark
+int irlap_data_release(struct irlap* lap, irlap_connection_addr_t hndl, unsigned int num_frames) {
+  struct irlap_connection* conn;
+  struct irlap_data* idata;
+  int err = 0;
+
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, hndl);
+  if(!conn) {
+    err = -IRLAP_ERR_NO_CONNECTION;
+    goto out_connections_locked;
+  }
+
+  idata = &conn->data;
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  idata->rx_queued -= min(num_frames, idata->rx_queued);
+  if(idata->local_busy && idata->rx_queued <= idata->rx_queue_low) {
+    IRLAP_DATA_LOGD(conn, "Receive queue drained to %u frames, accepting data again", idata->rx_queued);
+    idata->local_busy = false;
+  }
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+
+out_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  return err;
+}
+
+// Timers start once the turn has actually been handed over to the remote
+static void irlap_data_turn_sent(struct irlap* lap, int err, void* priv) {
+  irlap_connection_addr_t connection_addr = (irlap_connection_addr_t)(uintptr_t)priv;
+  struct irlap_connection* conn;
+
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, connection_addr);
+  if(!conn) {
+    goto out_connections_locked;
+  }
+
+  if(err) {
+    IRLAP_DATA_LOGW(conn, "Failed to transmit frames, relying on timeout for recovery: %d", err);
+  }
+
+  if(irlap_data_is_primary(lap)) {
+    err = irlap_connection_start_p_timer(conn, irlap_data_p_timeout);
+  } else {
+    err = irlap_connection_start_f_timer(conn, irlap_data_f_timeout);
+  }
+  if(err) {
+    IRLAP_DATA_LOGE(conn, "Failed to start %s timer: %d", irlap_data_is_primary(lap) ? "p" : "f", err);
+  }
+
+out_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+}
+
+static int irlap_data_send_supervisory(struct irlap_connection* conn, uint8_t type, bool pf) {
+  irlap_frame_hdr_t hdr = {
+    .connection_address = irlap_data_get_address(conn),
+    .control = IRLAP_FRAME_FORMAT_SUPERVISORY | type | IRLAP_FRAME_MAKE_NR(conn->data.vr),
+  };
+
+  if(pf) {
+    hdr.control |= IRLAP_FRAME_POLL_FINAL;
+  }
+  return irlap_tx_queue_frame(&conn->lap->tx, &hdr, NULL, 0, irlap_data_turn_sent, (void*)(uintptr_t)conn->connection_addr);
+}
+
+static int irlap_data_send_frmr(struct irlap_connection* conn) {
+  irlap_frame_hdr_t hdr = {
+    .connection_address = irlap_data_get_address(conn),
+    .control = IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_RESP_FRMR | IRLAP_RESP_FINAL,
+  };
+  struct irlap_data_fragment fragment = {
+    .data = conn->data.frmr,
+    .len = sizeof(conn->data.frmr),
+  };
+
+  return irlap_tx_queue_frame(&conn->lap->tx, &hdr, &fragment, 1, irlap_data_turn_sent, (void*)(uintptr_t)conn->connection_addr);
+}
+
+// Next frame to send, expedited traffic first
+static struct irlap_data_frame* irlap_data_peek_queued(struct irlap_data* idata) {
+  unsigned int i;
+
+  for(i = 0; i < IRLAP_DATA_PRIORITY_NUM; i++) {
+    if(!LIST_IS_EMPTY(&idata->tx_queues[i])) {
+      return LIST_GET_ENTRY(idata->tx_queues[i].next, struct irlap_data_frame, list);
+    }
+  }
+  return NULL;
+}
+
+static void irlap_data_add_frame(struct irlap_connection* conn, struct irlap_frame* frame, irlap_frame_hdr_t* hdr, uint8_t control, struct irlap_data_frame* data) {
+  hdr->connection_address = irlap_data_get_address(conn);
+  hdr->control = control;
+  frame->hdr = hdr;
+  frame->fragments = NULL;
+  frame->num_fragments = 0;
+  frame->wrapped = data ? &data->wrapped : NULL;
+  frame->ref = data ? &data->storage : NULL;
+}
+
+// Send everything permitted in this turn and hand the turn over with the P/F bit on the last frame
+int irlap_data_send_turn(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+  struct irlap_data* idata = &conn->data;
+  irlap_frame_hdr_t hdrs[IRLAP_FRAME_BURST_MAX];
+  struct irlap_frame frames[IRLAP_FRAME_BURST_MAX];
+  struct list_head ui_sent;
+  unsigned int window_size = conn->remote_negotiation_values.window_size;
+  size_t num_frames = 0;
+  size_t max_frames = IRLAP_FRAME_BURST_MAX;
+  // Primary is limited by its poll scheduler deficit, secondaries answer with whatever they have
+  size_t budget = SIZE_MAX;
+  bool primary = irlap_data_is_primary(lap);
+  bool final_is_information = false;
+  // Next frame did not fit into the budget
+  bool over_budget = false;
+  unsigned int gap_end = 0;
+  unsigned int i;
+  uint8_t seq;
+  int err;
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  if(conn->connection_state != IRLAP_CONNECTION_STATE_RECV) {
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+    return -IRLAP_ERR_STATION_STATE;
+  }
+  if(idata->frame_rejected) {
+    err = irlap_data_send_frmr(conn);
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+    return err;
+  }
+  if(primary) {
+    budget = conn->poll.deficit;
+  }
+  // Busy turns always end in RNR, there is no point in asking for frames
+  if(idata->local_busy) {
+    max_frames--;
+  } else {
+    // Ask for each frame missing in front of the out of sequence frames held back
+    for(i = 1; i < IRLAP_DATA_SEQ_MODULUS; i++) {
+      if(idata->rx_window[IRLAP_DATA_SEQ(idata->vr + i)]) {
+        gap_end = i;
+      }
+    }
+  }
+  idata->srej_sent = 0;
+  for(i = 0; i < gap_end; i++) {
+    seq = IRLAP_DATA_SEQ(idata->vr + i);
+    if(!idata->rx_window[seq]) {
+      irlap_data_add_frame(conn, &frames[num_frames], &hdrs[num_frames], IRLAP_FRAME_FORMAT_SUPERVISORY | IRLAP_CMD_SREJ | IRLAP_FRAME_MAKE_NR(seq), NULL);
+      num_frames++;
+      idata->srej_sent |= 1 << seq;
+    }
+  }
+  idata->rx_turn = 0;
+  idata->rx_unitdata = false;
+
+  // Unitdata is not flow controlled and goes first, one slot is kept for the final frame
+  INIT_LIST_HEAD(ui_sent);
+  while(!LIST_IS_EMPTY(&idata->ui_queue) && num_frames < max_frames - 1) {
+    struct irlap_data_frame* frame = LIST_GET_ENTRY(idata->ui_queue.next, struct irlap_data_frame, list);
+    if(frame->len > budget) {
+      break;
+    }
+    budget -= frame->len;
+    LIST_DELETE(&frame->list);
+    LIST_APPEND_TAIL(&frame->list, &ui_sent);
+    idata->ui_queued--;
+    irlap_data_add_frame(conn, &frames[num_frames], &hdrs[num_frames], IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_UI, frame);
+    num_frames++;
+  }
+
+  if(!idata->remote_busy && idata->srej_requested) {
+    // Remote holds on to everything else, only resend what it asked for
+    IRLAP_DATA_LOGD(conn, "Selectively retransmitting frames %02x", idata->srej_requested);
+    for(i = 0; i < IRLAP_DATA_SEQ_DIST(idata->va, idata->vs) && num_frames < max_frames; i++) {
+      seq = IRLAP_DATA_SEQ(idata->va + i);
+      if((idata->srej_requested & (1 << seq)) && idata->tx_window[seq]->len <= budget) {
+        budget -= idata->tx_window[seq]->len;
+        irlap_data_add_frame(conn, &frames[num_frames], &hdrs[num_frames], IRLAP_FRAME_FORMAT_INFORMATION | IRLAP_FRAME_MAKE_NS(seq) | IRLAP_FRAME_MAKE_NR(idata->vr), idata->tx_window[seq]);
+        num_frames++;
+        final_is_information = true;
+        idata->srej_requested &= ~(1 << seq);
+      }
+    }
+  } else if(!idata->srej_requested && idata->vs != idata->va) {
+    // Frames still unacknowledged after the remote's turn have been lost, go back N
+    IRLAP_DATA_LOGD(conn, "Retransmitting %u frames starting at %u", IRLAP_DATA_SEQ_DIST(idata->va, idata->vs), idata->va);
+    idata->vs = idata->va;
+  }
+
+  while(!idata->remote_busy && num_frames < max_frames && IRLAP_DATA_SEQ_DIST(idata->va, idata->vs) < window_size) {
+    struct irlap_data_frame* frame = idata->tx_window[idata->vs];
+    if(!frame) {
+      frame = irlap_data_peek_queued(idata);
+      if(!frame) {
+        break;
+      }
+    }
+    if(frame->len > budget) {
+      over_budget = true;
+      break;
+    }
+    if(!idata->tx_window[idata->vs]) {
+      LIST_DELETE(&frame->list);
+      idata->tx_window[idata->vs] = frame;
+    }
+    budget -= frame->len;
+
+    irlap_data_add_frame(conn, &frames[num_frames], &hdrs[num_frames], IRLAP_FRAME_FORMAT_INFORMATION | IRLAP_FRAME_MAKE_NS(idata->vs) | IRLAP_FRAME_MAKE_NR(idata->vr), frame);
+    num_frames++;
+    final_is_information = true;
+    idata->vs = IRLAP_DATA_SEQ(idata->vs + 1);
+  }
+
+  // Nothing to send, acknowledge and hand over the turn. Window gaps are less than the burst size, there is always room
+  if(!final_is_information || idata->local_busy) {
+    uint8_t type = IRLAP_CMD_RR;
+    if(idata->local_busy) {
+      type = IRLAP_CMD_RNR;
+    } else if(idata->reject_pending && !idata->srej_sent) {
+      type = IRLAP_CMD_REJ;
+    }
+    irlap_data_add_frame(conn, &frames[num_frames], &hdrs[num_frames], IRLAP_FRAME_FORMAT_SUPERVISORY | type | IRLAP_FRAME_MAKE_NR(idata->vr), NULL);
+    num_frames++;
+  }
+  hdrs[num_frames - 1].control |= IRLAP_FRAME_POLL_FINAL;
+  // Deficit round robin, unused credit only carries over to a frame too large for it. Turns cut
+  // short by the window or burst size would otherwise let the deficit grow without bound
+  if(primary) {
+    conn->poll.deficit = over_budget ? budget : 0;
+  }
+
+  err = irlap_tx_queue_frame_burst(&lap->tx, frames, num_frames, irlap_data_turn_sent, (void*)(uintptr_t)conn->connection_addr);
+  if(err) {
+    IRLAP_DATA_LOGE(conn, "Failed to queue frames for transmission: %d", err);
+  } else {
+    idata->reject_pending = false;
+  }
+  // Tx requests hold their own frame references, unitdata is never retransmitted
+  irlap_data_put_queue(lap, &ui_sent);
+
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+  return err;
+}
+
+// Release all frames acknowledged by nr, caller must hold the connection state lock
+static int irlap_data_ack(struct irlap_connection* conn, uint8_t nr) {
+  struct irlap* lap = conn->lap;
+  struct irlap_data* idata = &conn->data;
+
+  if(IRLAP_DATA_SEQ_DIST(idata->va, nr) > IRLAP_DATA_SEQ_DIST(idata->va, idata->vs)) {
+    IRLAP_DATA_LOGW(conn, "Got invalid Nr %u, expected Nr between %u and %u", nr, idata->va, idata->vs);
+    return -EINVAL;
+  }
+
+  while(idata->va != nr) {
+    irlap_data_frame_put(lap, idata->tx_window[idata->va]);
+    idata->tx_window[idata->va] = NULL;
+    idata->srej_requested &= ~(1 << idata->va);
+    idata->va = IRLAP_DATA_SEQ(idata->va + 1);
+  }
+  return 0;
+}
+
+static void irlap_data_deliver(struct irlap_connection* conn, uint8_t* data, size_t len) {
+  struct irlap* lap = conn->lap;
+  struct irlap_data* idata = &conn->data;
+
+  idata->vr = IRLAP_DATA_SEQ(idata->vr + 1);
+  if(idata->rx_queue_high && ++idata->rx_queued >= idata->rx_queue_high) {
+    if(!idata->local_busy) {
+      IRLAP_DATA_LOGD(conn, "Receive queue full with %u frames, signalling busy", idata->rx_queued);
+    }
+    idata->local_busy = true;
+  }
+  if(lap->services.data.indication) {
+    lap->services.data.indication(conn->connection_addr, data, len, lap->priv);
+  }
+}
+
+// Hold on to a frame received ahead of a gap until the missing frames have been selectively retransmitted
+static bool irlap_data_hold_back(struct irlap_connection* conn, uint8_t ns, uint8_t* data, size_t len) {
+  struct irlap* lap = conn->lap;
+  struct irlap_data* idata = &conn->data;
+  struct irlap_data_frame* frame;
+
+  if(!idata->selective_reject || IRLAP_DATA_SEQ_DIST(idata->vr, ns) >= conn->local_negotiation_values.window_size) {
+    return false;
+  }
+  if(idata->rx_window[ns]) {
+    return true;
+  }
+  if(len > IRLAP_MAX_DATA_SIZE) {
+    return false;
+  }
+
+  frame = irlap_data_frame_get(lap);
+  if(!frame) {
+    IRLAP_DATA_LOGD(conn, "Data frame pool exhausted, can't hold back out of sequence frame");
+    return false;
+  }
+  memcpy(frame->data, data, len);
+  frame->len = len;
+  frame->buffer = NULL;
+  idata->rx_window[ns] = frame;
+  return true;
+}
+
+static void irlap_data_handle_information(struct irlap_connection* conn, uint8_t ns, uint8_t* data, size_t len) {
+  struct irlap* lap = conn->lap;
+  struct irlap_data* idata = &conn->data;
+
+  // Not acknowledged, remote resends it once we are ready again
+  if(idata->local_busy) {
+    IRLAP_DATA_LOGV(conn, "Dropping I frame %u, receiver busy", ns);
+    return;
+  }
+
+  idata->rx_turn |= 1 << ns;
+  if(ns != idata->vr) {
+    IRLAP_DATA_LOGD(conn, "Got out of sequence I frame, Ns %u != Vr %u", ns, idata->vr);
+    idata->turn_error = true;
+    if(!irlap_data_hold_back(conn, ns, data, len)) {
+      idata->reject_pending = true;
+    }
+    return;
+  }
+
+  idata->reject_pending = false;
+  irlap_data_deliver(conn, data, len);
+  // Gap closed, pass on everything held back behind it
+  while(idata->rx_window[idata->vr]) {
+    struct irlap_data_frame* frame = idata->rx_window[idata->vr];
+    idata->rx_window[idata->vr] = NULL;
+    irlap_data_deliver(conn, frame->data, frame->len);
+    irlap_data_frame_put(lap, frame);
+  }
+}
+
+// Peers not implementing SREJ will never answer it, stop asking
+static void irlap_data_check_srej(struct irlap_connection* conn) {
+  struct irlap* lap = conn->lap;
+  struct irlap_data* idata = &conn->data;
+
+  if(!idata->srej_sent) {
+    return;
+  }
+  if(idata->srej_sent & idata->rx_turn) {
+    idata->srej_ignored = 0;
+    return;
+  }
+  if(++idata->srej_ignored >= IRLAP_DATA_SREJ_IGNORED_MAX) {
+    IRLAP_DATA_LOGI(conn, "Remote ignores SREJ, falling back to REJ");
+    idata->selective_reject = false;
+    irlap_data_put_window(lap, idata->rx_window);
+    idata->reject_pending = true;
+  }
+}
+
+static void irlap_data_handle_supervisory(struct irlap_connection* conn, uint8_t type) {
+  struct irlap_data* idata = &conn->data;
+
+  switch(type) {
+    case IRLAP_CMD_RR:
+      idata->remote_busy = false;
+      break;
+    case IRLAP_CMD_RNR:
+      idata->remote_busy = true;
+      break;
+    case IRLAP_CMD_REJ:
+      // Everything from Nr onwards is retransmitted on our next turn
+      idata->turn_error = true;
+      idata->remote_busy = false;
+      idata->srej_requested = 0;
+      idata->vs = idata->va;
+      break;
+  }
+}
+
+// SREJ names a single frame to retransmit, its Nr does not acknowledge anything
+static void irlap_data_handle_srej(struct irlap_connection* conn, uint8_t nr) {
+  struct irlap_data* idata = &conn->data;
+
+  if(IRLAP_DATA_SEQ_DIST(idata->va, nr) >= IRLAP_DATA_SEQ_DIST(idata->va, idata->vs)) {
+    IRLAP_DATA_LOGW(conn, "Got SREJ for frame %u outside of window %u to %u", nr, idata->va, idata->vs);
+    return;
+  }
+  idata->remote_busy = false;
+  idata->turn_error = true;
+  idata->srej_requested |= 1 << nr;
+}
+
+// Account for one turn, caller must hold the connection state lock
+static irlap_data_link_action_t irlap_data_update_link_quality(struct irlap_connection* conn, bool error) {
+  struct irlap_data* idata = &conn->data;
+
+  if(error) {
+    idata->error_rate += (IRLAP_DATA_ERROR_RATE_ONE - idata->error_rate) >> IRLAP_DATA_ERROR_RATE_SHIFT;
+  } else {
+    idata->error_rate -= idata->error_rate >> IRLAP_DATA_ERROR_RATE_SHIFT;
+  }
+  if(idata->error_samples < IRLAP_DATA_ERROR_SAMPLES_MIN) {
+    idata->error_samples++;
+    return IRLAP_DATA_LINK_OK;
+  }
+
+  if(idata->error_rate > IRLAP_DATA_ERROR_RATE_HIGH) {
+    IRLAP_DATA_LOGD(conn, "Link error rate at %u/%u", idata->error_rate, IRLAP_DATA_ERROR_RATE_ONE);
+    return IRLAP_DATA_LINK_STEP_DOWN;
+  }
+  if(idata->error_rate >= IRLAP_DATA_ERROR_RATE_LOW) {
+    idata->clean_turns = 0;
+    return IRLAP_DATA_LINK_OK;
+  }
+  if(++idata->clean_turns >= IRLAP_DATA_CLEAN_TURNS_STEP_UP) {
+    idata->clean_turns = 0;
+    return IRLAP_DATA_LINK_STEP_UP;
+  }
+  return IRLAP_DATA_LINK_OK;
+}
+
+// Only primaries can reconnect, the connection is taken down instead of being polled again
+static bool irlap_data_check_link(struct irlap_connection* conn, bool error) {
+  irlap_data_link_action_t action;
+
+  if(!irlap_data_is_primary(conn->lap)) {
+    return false;
+  }
+  action = irlap_data_update_link_quality(conn, error);
+  if(action == IRLAP_DATA_LINK_OK) {
+    return false;
+  }
+  return !irlap_connect_renegotiate(conn, action == IRLAP_DATA_LINK_STEP_UP);
+}
+
+// Remote handed over the turn, caller must hold the station state lock
+static void irlap_data_turn_received(struct irlap* lap, struct irlap_connection* conn) {
+  struct irlap_data* idata = &conn->data;
+  struct irlap_connection* next;
+  bool primary = irlap_data_is_primary(lap);
+  bool renegotiate;
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  irlap_data_check_srej(conn);
+  idata->retry_count = 0;
+  if(primary) {
+    irlap_connection_stop_p_timer(conn);
+    irlap_poll_update(conn);
+  } else {
+    irlap_connection_stop_f_timer(conn);
+  }
+  // Frames of our last turn still unacknowledged have been lost
+  renegotiate = irlap_data_check_link(conn, idata->turn_error || (idata->vs != idata->va && !idata->remote_busy));
+  idata->turn_error = false;
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+  if(renegotiate) {
+    return;
+  }
+
+  // Primary decides which secondary gets the next turn and when
+  next = conn;
+  if(primary) {
+    next = irlap_poll_next(lap, conn);
+    if(irlap_poll_defer(lap, next)) {
+      return;
+    }
+  }
+  irlap_data_send_turn(next);
+}
+
+// Primary can't recover from a protocol error on its own, the link is reset or given up.
+// Caller must hold the station state lock
+static void irlap_data_reset_link(struct irlap* lap, struct irlap_connection* conn) {
+  struct irlap_connection* next;
+
+  if(!irlap_connect_reset(conn)) {
+    return;
+  }
+  IRLAP_DATA_LOGW(conn, "Can't reset link, closing connection");
+  irlap_connection_close(conn);
+  next = irlap_poll_next(lap, NULL);
+  if(next) {
+    irlap_data_send_turn(next);
+  }
+}
+
+// Secondary enters the frame reject condition, caller must hold the connection state lock
+static void irlap_data_reject_frame(struct irlap_connection* conn, uint8_t control, bool command) {
+  struct irlap_data* idata = &conn->data;
+
+  idata->frame_rejected = true;
+  idata->frmr[0] = control;
+  idata->frmr[1] = (idata->vs << 1) | (idata->vr << 5) | (command ? 0 : IRLAP_DATA_FRMR_CR);
+  idata->frmr[2] = IRLAP_DATA_FRMR_INVALID_NR;
+}
+
+int irlap_data_handle_frame(struct irlap* lap, struct irlap_connection* conn, union irlap_frame_hdr* hdr, uint8_t* data, size_t len) {
+  bool pf = IRLAP_FRAME_IS_POLL_FINAL(hdr);
+  bool primary;
+  int err = IRLAP_FRAME_HANDLED;
+
+  if(!conn) {
+    return IRLAP_FRAME_NOT_HANDLED;
+  }
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  if(lap->state != IRLAP_STATION_MODE_NRM || conn->connection_state != IRLAP_CONNECTION_STATE_RECV) {
+    IRLAP_DATA_LOGD(conn, "Ignoring numbered frame outside of data phase");
+    err = -IRLAP_ERR_STATION_STATE;
+    goto out_state_locked;
+  }
+
+  // Primary only accepts responses, secondary only commands
+  primary = irlap_data_is_primary(lap);
+  if(primary == IRLAP_FRAME_IS_COMMAND(hdr)) {
+    IRLAP_DATA_LOGD(conn, "Ignoring %s frame, station is %s", IRLAP_FRAME_IS_COMMAND(hdr) ? "command" : "response", primary ? "primary" : "secondary");
+    err = IRLAP_FRAME_NOT_HANDLED;
+    goto out_state_locked;
+  }
+  if(primary) {
+    irlap_connection_rtt_sample(conn, pf);
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  if(conn->data.frame_rejected) {
+    IRLAP_DATA_LOGD(conn, "Ignoring numbered frame, waiting for link reset");
+  } else if(IRLAP_FRAME_IS_SUPERVISORY(hdr) && (hdr->control & IRLAP_SUPERVISORY_MASK) == IRLAP_CMD_SREJ) {
+    irlap_data_handle_srej(conn, IRLAP_FRAME_NR(hdr->control));
+  } else if(irlap_data_ack(conn, IRLAP_FRAME_NR(hdr->control))) {
+    if(primary) {
+      irlap_lock_put_reentrant(lap, conn->state_lock);
+      irlap_data_reset_link(lap, conn);
+      goto out_state_locked;
+    }
+    irlap_data_reject_frame(conn, hdr->control, IRLAP_FRAME_IS_COMMAND(hdr));
+  } else if(IRLAP_FRAME_IS_INFORMATION(hdr)) {
+    irlap_data_handle_information(conn, IRLAP_FRAME_NS(hdr->control), data, len);
+  } else if(IRLAP_FRAME_IS_SUPERVISORY(hdr)) {
+    irlap_data_handle_supervisory(conn, hdr->control & IRLAP_SUPERVISORY_MASK);
+  }
+
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+
+  if(pf) {
+    irlap_data_turn_received(lap, conn);
+  }
+
+out_state_locked:
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  return err;
+}
+
+// UI frame on the connection, may hand over the turn just like numbered frames
+int irlap_data_handle_unitdata(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf, bool command) {
+  int err = IRLAP_FRAME_HANDLED;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  if(lap->state != IRLAP_STATION_MODE_NRM || conn->connection_state != IRLAP_CONNECTION_STATE_RECV) {
+    IRLAP_DATA_LOGD(conn, "Ignoring unitdata outside of data phase");
+    err = -IRLAP_ERR_STATION_STATE;
+    goto out_state_locked;
+  }
+
+  if(irlap_data_is_primary(lap) == command) {
+    err = IRLAP_FRAME_NOT_HANDLED;
+    goto out_state_locked;
+  }
+  if(!command) {
+    irlap_connection_rtt_sample(conn, pf);
+  }
+  // Keeps the secondary from being considered idle by the poll scheduler
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  conn->data.rx_unitdata = true;
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+
+  if(lap->services.data.unitdata_indication) {
+    lap->services.data.unitdata_indication(conn->connection_addr, data, len, lap->priv);
+  }
+
+  if(pf) {
+    irlap_data_turn_received(lap, conn);
+  }
+
+out_state_locked:
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  return err;
+}
+
+// Secondary rejected one of our frames, only a link reset gets both sides back in sync
+int irlap_data_handle_frmr_resp(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf) {
+  int err = IRLAP_FRAME_HANDLED;
+
+  if(!conn) {
+    return -IRLAP_ERR_NO_CONNECTION;
+  }
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  if(lap->state != IRLAP_STATION_MODE_NRM || conn->connection_state != IRLAP_CONNECTION_STATE_RECV ||
+     !irlap_data_is_primary(lap)) {
+    err = -IRLAP_ERR_STATION_STATE;
+    goto out_state_locked;
+  }
+
+  if(len >= IRLAP_DATA_FRMR_LEN) {
+    IRLAP_DATA_LOGW(conn, "Secondary rejected frame with control %02x, reason %02x", data[0], data[2]);
+  } else {
+    IRLAP_DATA_LOGW(conn, "Secondary rejected frame");
+  }
+  irlap_data_reset_link(lap, conn);
+
+out_state_locked:
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  return err;
+}
+
+// Primary did not get a final frame in time, poll again or give up
+void irlap_data_p_timeout(void* priv) {
+  struct irlap_connection* conn = priv;
+  struct irlap_connection* next;
+  struct irlap* lap = conn->lap;
+  int err;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  // Connection storage is pooled, make sure conn has not been closed in the meantime
+  if(irlap_connection_get(lap, conn->connection_addr) != conn) {
+    goto out_connections_locked;
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  conn->p_timer = IRHAL_TIMER_INVALID;
+  if(irlap_data_check_link(conn, true)) {
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+    goto out_connections_locked;
+  }
+  if(++conn->data.retry_count > irlap_data_get_retry_limit(conn)) {
+    IRLAP_DATA_LOGW(conn, "No response from secondary after %u polls, closing connection", conn->data.retry_count - 1);
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+    irlap_connection_close(conn);
+    // Carry on with the remaining secondaries
+    next = irlap_poll_next(lap, NULL);
+    if(next) {
+      irlap_data_send_turn(next);
+    }
+    goto out_connections_locked;
+  }
+
+  // Secondary's answer to a plain poll tells us which frames made it
+  err = irlap_data_send_supervisory(conn, IRLAP_CMD_RR, true);
+  if(err) {
+    IRLAP_DATA_LOGE(conn, "Failed to queue poll frame: %d", err);
+  }
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+
+out_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+// Secondary was not polled in time, keep waiting or give up
+void irlap_data_f_timeout(void* priv) {
+  struct irlap_connection* conn = priv;
+  struct irlap* lap = conn->lap;
+  int err;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  if(irlap_connection_get(lap, conn->connection_addr) != conn) {
+    goto out_connections_locked;
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  conn->f_timer = IRHAL_TIMER_INVALID;
+  if(++conn->data.retry_count > irlap_data_get_retry_limit(conn)) {
+    IRLAP_DATA_LOGW(conn, "Not polled by primary for %u timeouts, closing connection", conn->data.retry_count - 1);
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+    irlap_connection_close(conn);
+    goto out_connections_locked;
+  }
+
+  err = irlap_connection_start_f_timer(conn, irlap_data_f_timeout);
+  if(err) {
+    IRLAP_DATA_LOGE(conn, "Failed to restart f timer: %d", err);
+  }
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+
+out_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "irlap_defs.h"
+#include "../util/list.h"
+#include "../util/objpool.h"
+
+struct irlap;
+struct irlap_connection;
+union irlap_frame_hdr;
+
+#define IRLAP_DATA_SEQ_MODULUS 8
+#define IRLAP_DATA_SEQ(seq) ((seq) & (IRLAP_DATA_SEQ_MODULUS - 1))
+// Number of sequence numbers from from up to, but not including, to
+#define IRLAP_DATA_SEQ_DIST(from, to) IRLAP_DATA_SEQ((to) - (from))
+
+// Minimum number of unanswered polls before a connection is considered dead
+#define IRLAP_DATA_RETRY_LIMIT_MIN 3
+// Number of remote turns ignoring our SREJ frames before falling back to REJ
+#define IRLAP_DATA_SREJ_IGNORED_MAX 2
+
+// Connection mode UI frames waiting for a turn, the oldest one is dropped beyond that
+#ifndef IRLAP_DATA_UI_QUEUE_MAX
+#define IRLAP_DATA_UI_QUEUE_MAX 4
+#endif
+
+// Link quality is tracked as an exponentially weighted share of turns that needed recovery
+#define IRLAP_DATA_ERROR_RATE_ONE   65536
+#define IRLAP_DATA_ERROR_RATE_SHIFT 3
+// Reconnect with lower speed above this share of bad turns
+#ifndef IRLAP_DATA_ERROR_RATE_HIGH
+#define IRLAP_DATA_ERROR_RATE_HIGH (IRLAP_DATA_ERROR_RATE_ONE / 2)
+#endif
+// Try a higher speed again after IRLAP_DATA_CLEAN_TURNS_STEP_UP turns below this share
+#ifndef IRLAP_DATA_ERROR_RATE_LOW
+#define IRLAP_DATA_ERROR_RATE_LOW (IRLAP_DATA_ERROR_RATE_ONE / 50)
+#endif
+#define IRLAP_DATA_ERROR_SAMPLES_MIN 16
+#ifndef IRLAP_DATA_CLEAN_TURNS_STEP_UP
+#define IRLAP_DATA_CLEAN_TURNS_STEP_UP 1024
+#endif
+
+// Information field of a frmr resp: rejected control field, Vs and Vr, reason
+#define IRLAP_DATA_FRMR_LEN 3
+#define IRLAP_DATA_FRMR_CR         (1 << 4)
+#define IRLAP_DATA_FRMR_INVALID_NR (1 << 3)
+
+// Worst case size of a stuffed payload
+#define IRLAP_DATA_FRAME_SIZE (2 * IRLAP_MAX_DATA_SIZE)
+
+typedef enum {
+  // Control traffic, always sent before any bulk data
+  IRLAP_DATA_PRIORITY_EXPEDITED = 0,
+  IRLAP_DATA_PRIORITY_BULK,
+  IRLAP_DATA_PRIORITY_NUM,
+} irlap_data_priority_t;
+
+struct irlap_data_buffer;
+
+typedef enum {
+  IRLAP_DATA_LINK_OK = 0,
+  IRLAP_DATA_LINK_STEP_DOWN,
+  IRLAP_DATA_LINK_STEP_UP,
+} irlap_data_link_action_t;
+
+typedef void (*irlap_data_buffer_free_f)(struct irlap_data_buffer* buf);
+
+// Upper layer owned payload, referenced by queued frames until they have been acknowledged
+struct irlap_data_buffer {
+  atomic_uint refcount;
+  uint8_t* data;
+  size_t len;
+  irlap_data_buffer_free_f free;
+};
+
+// Payload of an I frame. Transmitted frames are kept stuffed for cheap retransmission,
+// received frames held back out of sequence are kept as is
+struct irlap_data_frame {
+  struct list_head list;
+  size_t len;
+  struct irlap_data_buffer* buffer;
+  // Tx requests hold a reference to the frame until it has been sent
+  struct irlap_data_buffer storage;
+  struct objpool* pool;
+  struct irlap_wrapped_payload wrapped;
+  uint8_t data[IRLAP_DATA_FRAME_SIZE];
+};
+
+struct irlap_data {
+  // Send state variable, receive state variable and oldest unacknowledged sequence number
+  uint8_t vs;
+  uint8_t vr;
+  uint8_t va;
+  // Sent but unacknowledged frames, indexed by Ns
+  struct irlap_data_frame* tx_window[IRLAP_DATA_SEQ_MODULUS];
+  // Frames received out of sequence, indexed by Ns
+  struct irlap_data_frame* rx_window[IRLAP_DATA_SEQ_MODULUS];
+  struct list_head tx_queues[IRLAP_DATA_PRIORITY_NUM];
+  // Unnumbered frames, sent once and never retransmitted
+  struct list_head ui_queue;
+  unsigned int ui_queued;
+  bool remote_busy;
+  bool reject_pending;
+  bool selective_reject;
+  // Bitmaps of sequence numbers, one bit per Ns
+  uint8_t srej_requested;
+  uint8_t srej_sent;
+  uint8_t rx_turn;
+  // UI frames received during the current remote turn
+  bool rx_unitdata;
+  unsigned int srej_ignored;
+  unsigned int retry_count;
+  // Receive credits, frames indicated but not yet released by the upper layer.
+  // Polls are answered with RNR from rx_queue_high until the queue drained to rx_queue_low
+  unsigned int rx_queued;
+  unsigned int rx_queue_high;
+  unsigned int rx_queue_low;
+  bool local_busy;
+  // Something went missing during the current remote turn
+  bool turn_error;
+  uint32_t error_rate;
+  unsigned int error_samples;
+  unsigned int clean_turns;
+  // Secondary answers every poll with a frmr resp until the primary resets the link
+  bool frame_rejected;
+  uint8_t frmr[IRLAP_DATA_FRMR_LEN];
+};
+
+typedef void (*irlap_data_indication_f)(irlap_connection_addr_t hndl, uint8_t* data, size_t len, void* priv);
+
+struct irlap_service_data {
+  irlap_data_indication_f indication;
+  // UI frames received on the connection
+  irlap_data_indication_f unitdata_indication;
+};
+
+// Caller holds the initial reference
+static inline void irlap_data_buffer_init(struct irlap_data_buffer* buf, uint8_t* data, size_t len, irlap_data_buffer_free_f free) {
+  atomic_init(&buf->refcount, 1);
+  buf->data = data;
+  buf->len = len;
+  buf->free = free;
+}
+
+static inline void irlap_data_buffer_get(struct irlap_data_buffer* buf) {
+  atomic_fetch_add_explicit(&buf->refcount, 1, memory_order_relaxed);
+}
+
+static inline void irlap_data_buffer_put(struct irlap_data_buffer* buf) {
+  if(atomic_fetch_sub_explicit(&buf->refcount, 1, memory_order_acq_rel) == 1 && buf->free) {
+    buf->free(buf);
+  }
+}
+
+// Go back N may have rewound Vs, the window starting at Va tells what the remote may hold
+static inline bool irlap_data_has_unacked(struct irlap_data* idata) {
+  return idata->tx_window[idata->va] != NULL;
+}
+
+static inline bool irlap_data_has_queued(struct irlap_data* idata) {
+  unsigned int i;
+  if(!LIST_IS_EMPTY(&idata->ui_queue)) {
+    return true;
+  }
+  for(i = 0; i < IRLAP_DATA_PRIORITY_NUM; i++) {
+    if(!LIST_IS_EMPTY(&idata->tx_queues[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void irlap_data_init(struct irlap_data* idata, bool selective_reject);
+void irlap_data_free(struct irlap_connection* conn);
+unsigned int irlap_data_reset(struct irlap_connection* conn);
+int irlap_data_request(struct irlap* lap, irlap_connection_addr_t hndl, const uint8_t* data, size_t len);
+int irlap_data_request_buffer(struct irlap* lap, irlap_connection_addr_t hndl, struct irlap_data_buffer* buf, irlap_data_priority_t priority);
+int irlap_data_unitdata_request(struct irlap* lap, irlap_connection_addr_t hndl, const uint8_t* data, size_t len);
+int irlap_data_set_rx_watermarks(struct irlap* lap, irlap_connection_addr_t hndl, unsigned int high, unsigned int low);
+int irlap_data_release(struct irlap* lap, irlap_connection_addr_t hndl, unsigned int num_frames);
+int irlap_data_send_turn(struct irlap_connection* conn);
+int irlap_data_handle_frame(struct irlap* lap, struct irlap_connection* conn, union irlap_frame_hdr* hdr, uint8_t* data, size_t len);
+int irlap_data_handle_unitdata(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf, bool command);
+int irlap_data_handle_frmr_resp(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool pf);
+void irlap_data_p_timeout(void* priv);
+void irlap_data_f_timeout(void* priv);
@@ -11,6 +11,32 @@ typedef uint32_t irlap_addr_t;
 typedef uint8_t irlap_connection_addr_t;
 typedef uint8_t irlap_control_t;
 
+union irlap_frame_hdr {
+  struct {
+    irlap_connection_addr_t connection_address;
+    irlap_control_t control;
+  };
+  uint8_t data[2];
+};
+
+typedef union irlap_frame_hdr irlap_frame_hdr_t;
+
+// Payload stuffed ahead of time, (re)transmitting it only needs header, fcs and framing
+struct irlap_wrapped_payload {
+  uint8_t* data;
+  size_t len;
+  size_t payload_len;
+  // Header fcs has been calculated with, other headers get their fcs patched
+  irlap_frame_hdr_t hdr;
+  uint16_t fcs;
+};
+
+// Backing storage for the stuffed header and trailer of a scatter-gather wrapped frame
+struct irlap_wrapper_iov_scratch {
+  uint8_t hdr[sizeof(irlap_frame_hdr_t) * 2];
+  uint8_t trailer[sizeof(uint16_t) * 2 + 1];
+};
+
 #define IRLAP_VERSION 0   // Always 0, see section section 5.7.1.4.1.4.1.5 IrLAP specification v1.1
 #define IRLAP_FORMAT_ID 1 // Always one, see section 5.7.1.4.1.3 IrLAP specification v1.1
 
@@ -18,6 +44,9 @@ typedef uint8_t irlap_control_t;
 
 #define IRLAP_BAUDRATE_CONTENTION 9600
 
+// Largest information field expected in contention mode, connectionless UI frames
+#define IRLAP_RX_DATA_SIZE_CONTENTION 384
+
 #define IRLAP_ERR_BASE                             0x400
 #define IRLAP_ERR_ADDRESS                         (IRLAP_ERR_BASE + 1)
 #define IRLAP_ERR_UNITDATA_TOO_LONG               (IRLAP_ERR_BASE + 2)
@@ -29,6 +58,7 @@ typedef uint8_t irlap_control_t;
 #define IRLAP_ERR_NO_COMMON_PARAMETERS_FOUND      (IRLAP_ERR_BASE + 8)
 #define IRLAP_ERR_NO_CONNECTION                   (IRLAP_ERR_BASE + 9)
 #define IRLAP_ERR_POLL                            (IRLAP_ERR_BASE + 10)
+#define IRLAP_ERR_DATA_TOO_LONG                   (IRLAP_ERR_BASE + 11)
 
 #define IRLAP_SLOT_TIMEOUT 50
 #define IRLAP_P_TIMEOUT_MAX 500
@@ -38,6 +68,40 @@ typedef uint8_t irlap_control_t;
 #define IRLAP_MAX_DATA_SIZE 2048
 #define IRLAP_MAX_DATA_SIZE 2048
 
+// Full window of I-frames plus one supervisory frame
+#define IRLAP_FRAME_BURST_MAX 8
+// Maximum number of spans in a scatter-gather burst, bursts needing more are coalesced
+#define IRLAP_FRAME_BURST_IOV_MAX 48
+
+// Worst case wrapped size of a single frame, every byte escaped
+#define IRLAP_FRAME_WRAPPED_SIZE(data_size) (1 + IRLAP_FRAME_ADDITIONAL_BOF_MAX + 2 * (2 + (data_size) + 2) + 1)
+#define IRLAP_FRAME_WRAPPED_SIZE_MAX IRLAP_FRAME_WRAPPED_SIZE(IRLAP_MAX_DATA_SIZE)
+
+// Object pool sizes, may be overridden at build time
+#ifndef IRLAP_POOL_NUM_FRAMES
+#define IRLAP_POOL_NUM_FRAMES 16
+#endif
+#ifndef IRLAP_POOL_NUM_CONNECTIONS
+#define IRLAP_POOL_NUM_CONNECTIONS 4
+#endif
+#ifndef IRLAP_POOL_NUM_DATA_FRAMES
+#define IRLAP_POOL_NUM_DATA_FRAMES 16
+#endif
+// Largest information field of any frame sent through the tx path other than I-frames,
+// those are referenced and never copied
+#ifndef IRLAP_TX_REQUEST_DATA_SIZE
+#define IRLAP_TX_REQUEST_DATA_SIZE IRLAP_RX_DATA_SIZE_CONTENTION
+#endif
+
+// Request single lost frames via SREJ instead of go-back-N, peers ignoring SREJ fall back to REJ
+#ifndef IRLAP_SELECTIVE_REJECT
+#define IRLAP_SELECTIVE_REJECT 1
+#endif
+
+#ifndef IRLAP_EVENTQUEUE_SIZE
+#define IRLAP_EVENTQUEUE_SIZE 32
+#endif
+
 #define IRLAP_ADDR_BCAST 0xFFFFFFFF
 #define IRLAP_ADDR_NULL  0x00000000
 
@@ -58,6 +122,15 @@ typedef uint8_t irlap_control_t;
 
 #define IRLAP_CONNECTION_ADDRESS_MASK_CMD_BIT(addr) ((addr) & IRLAP_CONNECTION_ADDRESS_MASK)
 
+// Connection addresses are 7 bit wide, the lowest bit is the C/R bit
+#define IRLAP_CONNECTION_TABLE_SIZE 128
+#define IRLAP_CONNECTION_ADDRESS_TO_INDEX(addr) (IRLAP_CONNECTION_ADDRESS_MASK_CMD_BIT(addr) >> 1)
+#define IRLAP_CONNECTION_INDEX_TO_ADDRESS(idx) ((irlap_connection_addr_t)((idx) << 1))
+
+// Index 0 is the NULL address, the broadcast address is the first invalid index
+#define IRLAP_CONNECTION_INDEX_MIN (IRLAP_CONNECTION_ADDRESS_TO_INDEX(IRLAP_CONNECTION_ADDRESS_NULL) + 1)
+#define IRLAP_CONNECTION_INDEX_MAX IRLAP_CONNECTION_ADDRESS_TO_INDEX(IRLAP_CONNECTION_ADDRESS_BCAST)
+
 #define IRLAP_FRAME_FORMAT_MASK        0b00000011
 #define IRLAP_FRAME_FORMAT_UNNUMBERED  0b00000011
 #define IRLAP_FRAME_FORMAT_SUPERVISORY 0b00000001
@@ -72,7 +145,17 @@ typedef uint8_t irlap_control_t;
 #define IRLAP_FRAME_IS_POLL_FINAL(hdr) (((hdr)->control & IRLAP_FRAME_POLL_FINAL) == IRLAP_FRAME_POLL_FINAL)
 #define IRLAP_FRAME_MASK_POLL_FINAL(ctl) ((ctl) & ~IRLAP_FRAME_POLL_FINAL)
 
+#define IRLAP_FRAME_IS_INFORMATION(hdr) (((hdr)->control & 0b00000001) == IRLAP_FRAME_FORMAT_INFORMATION)
+#define IRLAP_FRAME_IS_SUPERVISORY(hdr) (((hdr)->control & IRLAP_FRAME_FORMAT_MASK) == IRLAP_FRAME_FORMAT_SUPERVISORY)
+
 #define IRLAP_SUPERVISORY_NR_MASK 0b11100000
+#define IRLAP_SUPERVISORY_MASK    0b00001100
+#define IRLAP_INFORMATION_NS_MASK 0b00001110
+
+#define IRLAP_FRAME_NR(ctl) (((ctl) & IRLAP_SUPERVISORY_NR_MASK) >> 5)
+#define IRLAP_FRAME_NS(ctl) (((ctl) & IRLAP_INFORMATION_NS_MASK) >> 1)
+#define IRLAP_FRAME_MAKE_NR(nr) (((nr) << 5) & IRLAP_SUPERVISORY_NR_MASK)
+#define IRLAP_FRAME_MAKE_NS(ns) (((ns) << 1) & IRLAP_INFORMATION_NS_MASK)
 
 #define IRLAP_CMD_MASK 0b11101100
 #define IRLAP_CMD_SNRM 0b10000000
@@ -109,6 +192,10 @@ typedef enum {
   IRLAP_STATION_MODE_REPLY,
   IRLAP_STATION_MODE_SCONN,
   IRLAP_STATION_MODE_SSETUP,
+  // Primary waiting for the answer to its SNRM cmd
+  IRLAP_STATION_MODE_SETUP,
+  // Secondary waiting for the upper layer to accept a connection
+  IRLAP_STATION_MODE_CONN,
 } irlap_station_mode_t;
 
 #define IRLAP_STATE_IS_CONTENTION(state) ( \
@@ -126,6 +213,8 @@ typedef enum {
 typedef enum {
   IRLAP_CONNECTION_STATE_SETUP = 0,
   IRLAP_CONNECTION_STATE_RECV,
+  // Disconnecting to set the connection up again with different parameters
+  IRLAP_CONNECTION_STATE_DISC,
 } irlap_connection_state_t;
 
 #define IRLAP_CONNECTION_IS_NEGOTIATED(conn) ( \
@@ -136,5 +225,6 @@ typedef enum {
 #define IRLAP_FRAME_NOT_HANDLED 1
 
 #define IRLAP_INDIRECTION_DISCOVERY_BUSY 0
+#define IRLAP_INDIRECTION_TX_FLUSH       1
 
 typedef struct list_head irlap_connection_list_t;
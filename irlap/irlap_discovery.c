@@ -52,6 +52,65 @@ static void irlap_discovery_frame_init(struct irlap* lap, union irlap_xid_frame*
   frame->version = IRLAP_VERSION;
 }
 
+static void irlap_discovery_log_reset(irlap_discovery_log_list_t* list, struct irlap_discovery_log_arena* arena) {
+  INIT_LIST_HEAD(*list);
+  arena->num_entries = 0;
+}
+
+static void irlap_discovery_abort(struct irlap_discovery* disc) {
+  struct irlap* lap = IRLAP_DISCOVERY_TO_IRLAP(disc);
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  lap->state = IRLAP_STATION_MODE_NDM;
+  irlap_discovery_log_reset(&disc->discovery_log, &disc->arenas[disc->arena]);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+// Slot timer starts once the xid cmd has actually left the phy
+static void irlap_discovery_xid_cmd_sent(struct irlap* lap, int err, void* priv) {
+  struct irlap_discovery* disc = priv;
+  if(err) {
+    IRLAP_DISC_LOGE(disc, "Failed to send XID discovery cmd in slot %u: %d", disc->current_slot - 1, err);
+    irlap_discovery_abort(disc);
+    return;
+  }
+  err = irlap_set_timer(lap, IRLAP_SLOT_TIMEOUT, irlap_slot_timeout, disc);
+  if(err < 0) {
+    IRLAP_DISC_LOGE(disc, "Failed to set up discovery slot timeout after slot %u: %d", disc->current_slot - 1, err);
+    irlap_discovery_abort(disc);
+    return;
+  }
+  disc->slot_timer = err;
+}
+
+static void irlap_discovery_final_xid_cmd_sent(struct irlap* lap, int err, void* priv) {
+  struct irlap_discovery* disc = priv;
+  struct irlap_discovery_log_arena* final;
+  if(err) {
+    IRLAP_DISC_LOGE(disc, "Failed to send final discovery frame: %d", err);
+    irlap_discovery_abort(disc);
+    return;
+  }
+  irlap_lock_take(lap, disc->discovery_log_final_lock);
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  list_replace(&disc->discovery_log, &disc->discovery_log_final);
+  final = &disc->arenas[disc->arena];
+  // Next round collects into the other arena while this one is handed out
+  disc->arena ^= 1;
+  lap->state = IRLAP_STATION_MODE_NDM;
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+  if(disc->conflict_address == IRLAP_ADDR_NULL) {
+    if(lap->services.discovery.confirm) {
+      lap->services.discovery.confirm(IRLAP_DISCOVERY_RESULT_OK, &disc->discovery_log_final, final->entries, final->num_entries, lap->priv);
+    }
+  } else {
+    if(lap->services.new_address.confirm) {
+      lap->services.new_address.confirm(IRLAP_DISCOVERY_RESULT_OK, &disc->discovery_log_final, final->entries, final->num_entries, lap->priv);
+    }
+  }
+  irlap_discovery_log_reset(&disc->discovery_log_final, final);
+  irlap_lock_put(lap, disc->discovery_log_final_lock);
+}
+
 static int irlap_discovery_send_xid_cmd(struct irlap_discovery* disc) {
   int err;
   struct irlap* lap = IRLAP_DISCOVERY_TO_IRLAP(disc);
@@ -72,17 +131,11 @@ static int irlap_discovery_send_xid_cmd(struct irlap_discovery* disc) {
   frame.flags &= IRLAP_XID_FRAME_FLAGS_MASK;
   if(disc->current_slot < disc->num_slots) {
     frame.slot = disc->current_slot;
-    err = irlap_send_frame_single(lap, &hdr, frame.data, sizeof(frame.data));
+    err = irlap_tx_queue_frame_single(&lap->tx, &hdr, frame.data, sizeof(frame.data), irlap_discovery_xid_cmd_sent, disc);
     if(err) {
-      IRLAP_DISC_LOGE(disc, "Failed to send XID discovery cmd in slot %u: %d", frame.slot, err);
-      goto fail;
-    }
-    err = irlap_set_timer(lap, IRLAP_SLOT_TIMEOUT, irlap_slot_timeout, disc);
-    if(err < 0) {
-      IRLAP_DISC_LOGE(disc, "Failed to set up discovery slot timeout after slot %u: %d", frame.slot, err);
+      IRLAP_DISC_LOGE(disc, "Failed to queue XID discovery cmd in slot %u: %d", frame.slot, err);
       goto fail;
     }
-    disc->slot_timer = err;
     disc->current_slot++;
   } else {
     struct irlap_data_fragment fragments[] = {
@@ -90,41 +143,17 @@ static int irlap_discovery_send_xid_cmd(struct irlap_discovery* disc) {
       { disc->discovery_info, disc->discovery_info_len },
     };
     frame.slot = IRLAP_XID_SLOT_NUM_FINAL;
-    err = irlap_send_frame(lap, &hdr, fragments, ARRAY_LEN(fragments));
+    err = irlap_tx_queue_frame(&lap->tx, &hdr, fragments, ARRAY_LEN(fragments), irlap_discovery_final_xid_cmd_sent, disc);
     if(err) {
-      IRLAP_DISC_LOGE(disc, "Failed to send final discovery frame: %d", err);
+      IRLAP_DISC_LOGE(disc, "Failed to queue final discovery frame: %d", err);
       goto fail;
     }
-    irlap_lock_take(lap, disc->discovery_log_final_lock);
-    list_replace(&disc->discovery_log, &disc->discovery_log_final);
-    irlap_lock_take_reentrant(lap, lap->state_lock);
-    lap->state = IRLAP_STATION_MODE_NDM;
-    irlap_lock_put_reentrant(lap, lap->state_lock);
-    if(disc->conflict_address == IRLAP_ADDR_NULL) {
-      if(lap->services.discovery.confirm) {
-        lap->services.discovery.confirm(IRLAP_DISCOVERY_RESULT_OK, &disc->discovery_log_final, lap->priv);
-      }
-    } else {
-      if(lap->services.new_address.confirm) {
-        lap->services.new_address.confirm(IRLAP_DISCOVERY_RESULT_OK, &disc->discovery_log_final, lap->priv);
-      }
-    }
-    {
-      irlap_discovery_log_list_t *cursor, *next;
-      LIST_FOR_EACH_SAFE(cursor, next, &disc->discovery_log_final) {
-        struct irlap_discovery_log_entry* entry = LIST_GET_ENTRY(cursor, struct irlap_discovery_log_entry, list);
-        free(entry);
-      }
-    }
-    irlap_lock_put(lap, disc->discovery_log_final_lock);
   }
 
   return 0;
 
 fail:
-  irlap_lock_take_reentrant(lap, lap->state_lock);
-  lap->state = IRLAP_STATION_MODE_NDM;
-  irlap_lock_put_reentrant(lap, lap->state_lock);
+  irlap_discovery_abort(disc);
   return err;
 }
 
@@ -133,11 +162,11 @@ void irlap_discovery_indirect_busy(struct irlap* lap, void* data) {
   struct irlap_discovery* disc = &lap->discovery;
   if(is_null_addr) {
     if(lap->services.discovery.confirm) {
-      lap->services.discovery.confirm(IRLAP_DISCOVERY_RESULT_MEDIA_BUSY, NULL, lap->priv);
+      lap->services.discovery.confirm(IRLAP_DISCOVERY_RESULT_MEDIA_BUSY, NULL, NULL, 0, lap->priv);
     }
   } else {
     if(lap->services.new_address.confirm) {
-      lap->services.new_address.confirm(IRLAP_DISCOVERY_RESULT_MEDIA_BUSY, NULL, lap->priv);
+      lap->services.new_address.confirm(IRLAP_DISCOVERY_RESULT_MEDIA_BUSY, NULL, NULL, 0, lap->priv);
     }
   }
 }
@@ -183,7 +212,7 @@ static int irlap_discovery_request_(struct irlap_discovery* disc, uint8_t num_sl
   lap->state = IRLAP_STATION_MODE_QUERY;
   disc->num_slots = num_slots;
   disc->current_slot = 0;
-  INIT_LIST_HEAD(disc->discovery_log);
+  irlap_discovery_log_reset(&disc->discovery_log, &disc->arenas[disc->arena]);
 
   disc->conflict_address = new_addr;
 
@@ -351,7 +380,7 @@ static int irlap_discovery_handle_xid_cmd_discovery(struct irlap_discovery* disc
   int err = IRLAP_FRAME_HANDLED;
   uint8_t num_slots = irlap_discovery_slot_reverse_table[frame->flags & IRLAP_XID_FRAME_FLAGS_SLOT_MASK];
 
-  if(frame->dst_address != IRLAP_ADDR_BCAST && frame->dst_address != lap->address) {
+  if(frame->dst_address != IRLAP_ADDR_BCAST && frame->dst_address != irlap_get_address(lap)) {
     IRLAP_DISC_LOGV(disc, "Got xid discovery frame not addressed to us, dst: %08x", frame->dst_address);
     goto fail;
   }
@@ -425,6 +454,7 @@ static int irlap_discovery_handle_xid_resp_discovery_ndm(struct irlap_discovery*
 }
 
 static int irlap_discovery_handle_xid_resp_discovery_query(struct irlap_discovery* disc, union irlap_xid_frame* frame, uint8_t discovery_info_len) {
+  struct irlap_discovery_log_arena* arena;
   struct irlap_discovery_log_entry* entry;
 
   if(IRLAP_FRAME_IS_SNIFF(frame)) {
@@ -432,11 +462,13 @@ static int irlap_discovery_handle_xid_resp_discovery_query(struct irlap_discover
     return IRLAP_FRAME_NOT_HANDLED;
   }
 
-  entry = calloc(1, sizeof(struct irlap_discovery_log_entry));
-  if(!entry) {
-    IRLAP_DISC_LOGW(disc, "Failed to allocate memory for query log entry");
-    return -ENOMEM;
+  arena = &disc->arenas[disc->arena];
+  if(arena->num_entries >= ARRAY_LEN(arena->entries)) {
+    IRLAP_DISC_LOGW(disc, "Discovery log full, dropping query log entry");
+    return -ENOBUFS;
   }
+  entry = &arena->entries[arena->num_entries++];
+  memset(entry, 0, sizeof(*entry));
 
   entry->discovery_log.solicited = true;
   entry->discovery_log.sniff = IRLAP_FRAME_IS_SNIFF(frame);
@@ -11,6 +11,11 @@ typedef struct list_head irlap_discovery_log_list_t;
 #define IRLAP_DISCOVERY_MAX_SLOTS 16
 #define IRLAP_DISCOVERY_INFO_MAX_LEN 32
 
+// Maximum number of discovery log entries collected per round
+#ifndef IRLAP_DISCOVERY_LOG_MAX_ENTRIES
+#define IRLAP_DISCOVERY_LOG_MAX_ENTRIES 16
+#endif
+
 typedef enum {
   IRLAP_DISCOVERY_RESULT_OK = 0,
   IRLAP_DISCOVERY_RESULT_MEDIA_BUSY,
@@ -33,16 +38,23 @@ struct irlap_discovery_log_entry {
   struct irlap_discovery_log discovery_log;
 };
 
+// Bump allocated storage for the log entries of a single discovery round
+struct irlap_discovery_log_arena {
+  struct irlap_discovery_log_entry entries[IRLAP_DISCOVERY_LOG_MAX_ENTRIES];
+  size_t num_entries;
+};
+
 
 typedef int (*irlap_discovery_indication_f)(struct irlap_discovery_log* log, void* priv);
-typedef int (*irlap_discovery_confirm_f)(irlap_discovery_result_t result, irlap_discovery_log_list_t* list, void* priv);
+// entries is an array view of list, the callback may reorder it but must not use list afterwards
+typedef int (*irlap_discovery_confirm_f)(irlap_discovery_result_t result, irlap_discovery_log_list_t* list, struct irlap_discovery_log_entry* entries, size_t num_entries, void* priv);
 
 struct irlap_service_discovery {
   irlap_discovery_indication_f indication;
   irlap_discovery_confirm_f confirm;
 };
 
-typedef int (*irlap_new_address_confirm_f)(irlap_discovery_result_t result, irlap_discovery_log_list_t* list, void* priv);
+typedef int (*irlap_new_address_confirm_f)(irlap_discovery_result_t result, irlap_discovery_log_list_t* list, struct irlap_discovery_log_entry* entries, size_t num_entries, void* priv);
 
 struct irlap_service_new_address {
   irlap_new_address_confirm_f confirm;
@@ -58,6 +70,9 @@ struct irlap_discovery {
   irlap_discovery_log_list_t discovery_log;
   irlap_discovery_log_list_t discovery_log_final;
   void* discovery_log_final_lock;
+  // Current round collects into arenas[arena], the other one backs discovery_log_final
+  struct irlap_discovery_log_arena arenas[2];
+  uint8_t arena;
   uint8_t slot;
   bool frame_sent;
   irlap_addr_t conflict_address;
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -132,6 +133,243 @@ ssize_t irlap_wrapper_wrap(irlap_frame_wrapper_t wrapper, uint8_t* dst, size_t d
   return -EINVAL;
 }
 
+static const uint8_t irlap_wrapper_async_bofs[IRLAP_FRAME_ADDITIONAL_BOF_MAX + 1] = {
+  [0 ... IRLAP_FRAME_ADDITIONAL_BOF_MAX - 1] = IRLAP_FRAME_WRAP_ASYNC_BOF_ADDITIONAL,
+  [IRLAP_FRAME_ADDITIONAL_BOF_MAX] = IRLAP_FRAME_WRAP_ASYNC_BOF,
+};
+
+static const uint8_t irlap_wrapper_async_escape_ce[] = { IRLAP_FRAME_WRAP_ASYNC_CE, IRLAP_FRAME_WRAP_ASYNC_CE ^ IRLAP_FRAME_WRAP_ASYNC_XOR };
+static const uint8_t irlap_wrapper_async_escape_bof[] = { IRLAP_FRAME_WRAP_ASYNC_CE, IRLAP_FRAME_WRAP_ASYNC_BOF ^ IRLAP_FRAME_WRAP_ASYNC_XOR };
+static const uint8_t irlap_wrapper_async_escape_eof[] = { IRLAP_FRAME_WRAP_ASYNC_CE, IRLAP_FRAME_WRAP_ASYNC_EOF ^ IRLAP_FRAME_WRAP_ASYNC_XOR };
+
+static const uint8_t* irlap_wrapper_async_escape_sequence(uint8_t c) {
+  switch(c) {
+    case IRLAP_FRAME_WRAP_ASYNC_CE:
+      return irlap_wrapper_async_escape_ce;
+    case IRLAP_FRAME_WRAP_ASYNC_BOF:
+      return irlap_wrapper_async_escape_bof;
+    case IRLAP_FRAME_WRAP_ASYNC_EOF:
+      return irlap_wrapper_async_escape_eof;
+  }
+  return NULL;
+}
+
+static bool irlap_wrapper_iov_push(struct iovec* iov, size_t max_iov, size_t* num_iov, const void* data, size_t len) {
+  if(*num_iov >= max_iov) {
+    return false;
+  }
+  iov[*num_iov].iov_base = (void*)data;
+  iov[*num_iov].iov_len = len;
+  (*num_iov)++;
+  return true;
+}
+
+// Reference unescaped runs of data directly, escape sequences come from static tables
+static bool irlap_wrapper_wrap_async_data_iov(struct iovec* iov, size_t max_iov, size_t* num_iov, uint8_t* data, size_t len) {
+  uint8_t* run = data;
+  while(len-- > 0) {
+    const uint8_t* escape = irlap_wrapper_async_escape_sequence(*data);
+    if(escape) {
+      if(data > run && !irlap_wrapper_iov_push(iov, max_iov, num_iov, run, data - run)) {
+        return false;
+      }
+      if(!irlap_wrapper_iov_push(iov, max_iov, num_iov, escape, 2)) {
+        return false;
+      }
+      run = data + 1;
+    }
+    data++;
+  }
+  if(data > run && !irlap_wrapper_iov_push(iov, max_iov, num_iov, run, data - run)) {
+    return false;
+  }
+  return true;
+}
+
+static ssize_t irlap_wrapper_wrap_async_iov(struct iovec* iov, size_t max_iov, struct irlap_wrapper_iov_scratch* scratch, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments, unsigned int num_additional_bof) {
+  union {
+    uint16_t crc;
+    uint8_t data[2];
+  } crc;
+  size_t num_iov = 0;
+  size_t len;
+  uint8_t* trailer;
+
+  if(num_additional_bof > IRLAP_FRAME_ADDITIONAL_BOF_MAX) {
+    return -EINVAL;
+  }
+
+  // Additional BOFs and actual BOF
+  if(!irlap_wrapper_iov_push(iov, max_iov, &num_iov, &irlap_wrapper_async_bofs[IRLAP_FRAME_ADDITIONAL_BOF_MAX - num_additional_bof], num_additional_bof + 1)) {
+    return -ENOBUFS;
+  }
+
+  // Header
+  len = irlap_wrapper_wrap_async_data(scratch->hdr, hdr->data, sizeof(hdr->data), NULL);
+  if(!irlap_wrapper_iov_push(iov, max_iov, &num_iov, scratch->hdr, len)) {
+    return -ENOBUFS;
+  }
+
+  // Payload
+  crc.crc = irda_crc_ccitt_init();
+  crc.crc = irda_crc_ccitt_update(crc.crc, hdr->data, sizeof(hdr->data));
+  while(num_fragments-- > 0) {
+    if(!irlap_wrapper_wrap_async_data_iov(iov, max_iov, &num_iov, fragments->data, fragments->len)) {
+      return -ENOBUFS;
+    }
+    crc.crc = irda_crc_ccitt_update(crc.crc, fragments->data, fragments->len);
+    fragments++;
+  }
+
+  // CRC and EOF
+  crc.crc = irda_crc_ccitt_final(crc.crc);
+  len = irlap_wrapper_wrap_async_data(scratch->trailer, crc.data, sizeof(crc.data), &trailer);
+  *trailer = IRLAP_FRAME_WRAP_ASYNC_EOF;
+  len++;
+  if(!irlap_wrapper_iov_push(iov, max_iov, &num_iov, scratch->trailer, len)) {
+    return -ENOBUFS;
+  }
+
+  return num_iov;
+}
+
+// Wrap frame into a list of spans referencing the fragments instead of copying them
+// Returns number of iovecs used or -ENOBUFS if max_iov is insufficient
+ssize_t irlap_wrapper_wrap_iov(irlap_frame_wrapper_t wrapper, struct iovec* iov, size_t max_iov, struct irlap_wrapper_iov_scratch* scratch, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments, unsigned int num_additional_bof) {
+  switch(wrapper) {
+    case IRLAP_FRAME_WRAPPER_ASYNC:
+      return irlap_wrapper_wrap_async_iov(iov, max_iov, scratch, hdr, fragments, num_fragments, num_additional_bof);
+  }
+  return -EINVAL;
+}
+
+// Stuff payload into dst once, the fcs is kept for hdr and patched whenever the header changes.
+// With reference set, payloads without any bytes to escape are used in place and must outlive wrapped
+ssize_t irlap_wrapper_prewrap(irlap_frame_wrapper_t wrapper, struct irlap_wrapped_payload* wrapped, uint8_t* dst, size_t dst_len, irlap_frame_hdr_t* hdr, uint8_t* data, size_t len, bool reference) {
+  size_t wrapped_len;
+
+  if(wrapper != IRLAP_FRAME_WRAPPER_ASYNC) {
+    return -EINVAL;
+  }
+
+  wrapped_len = irlap_wrapper_get_wrapped_size_async_(data, len);
+  if(reference && wrapped_len == len) {
+    wrapped->data = data;
+    wrapped->len = len;
+  } else {
+    if(wrapped_len > dst_len) {
+      return -EINVAL;
+    }
+    wrapped->data = dst;
+    wrapped->len = irlap_wrapper_wrap_async_data(dst, data, len, NULL);
+  }
+  wrapped->payload_len = len;
+  wrapped->hdr = *hdr;
+  wrapped->fcs = irda_crc_ccitt_init();
+  wrapped->fcs = irda_crc_ccitt_update(wrapped->fcs, hdr->data, sizeof(hdr->data));
+  wrapped->fcs = irda_crc_ccitt_update(wrapped->fcs, data, len);
+  wrapped->fcs = irda_crc_ccitt_final(wrapped->fcs);
+  return wrapped->len;
+}
+
+static uint16_t irlap_wrapper_prewrapped_fcs(irlap_frame_hdr_t* hdr, struct irlap_wrapped_payload* wrapped) {
+  uint16_t fcs = wrapped->fcs;
+  size_t i;
+
+  for(i = 0; i < sizeof(hdr->data); i++) {
+    uint8_t delta = hdr->data[i] ^ wrapped->hdr.data[i];
+    if(delta) {
+      fcs = irda_crc_ccitt_patch(fcs, delta, sizeof(hdr->data) - i - 1 + wrapped->payload_len);
+    }
+  }
+  return fcs;
+}
+
+ssize_t irlap_wrapper_get_prewrapped_size(irlap_frame_wrapper_t wrapper, irlap_frame_hdr_t* hdr, struct irlap_wrapped_payload* wrapped, unsigned int num_additional_bof) {
+  union {
+    uint16_t crc;
+    uint8_t data[2];
+  } crc;
+  size_t wrapped_size;
+
+  if(wrapper != IRLAP_FRAME_WRAPPER_ASYNC) {
+    return -EINVAL;
+  }
+
+  crc.crc = irlap_wrapper_prewrapped_fcs(hdr, wrapped);
+  // BOFs and EOF
+  wrapped_size = num_additional_bof + 1 + 1;
+  wrapped_size += irlap_wrapper_get_wrapped_size_async_(hdr->data, sizeof(hdr->data));
+  wrapped_size += wrapped->len;
+  wrapped_size += irlap_wrapper_get_wrapped_size_async_(crc.data, sizeof(crc.data));
+  return wrapped_size;
+}
+
+ssize_t irlap_wrapper_wrap_prewrapped(irlap_frame_wrapper_t wrapper, uint8_t* dst, size_t dst_len, irlap_frame_hdr_t* hdr, struct irlap_wrapped_payload* wrapped, unsigned int num_additional_bof) {
+  union {
+    uint16_t crc;
+    uint8_t data[2];
+  } crc;
+  uint8_t* frame_start = dst;
+  ssize_t required_len = irlap_wrapper_get_prewrapped_size(wrapper, hdr, wrapped, num_additional_bof);
+  if(required_len < 0) {
+    return required_len;
+  }
+  if(required_len > dst_len) {
+    return -EINVAL;
+  }
+
+  while(num_additional_bof-- > 0) {
+    *dst++ = IRLAP_FRAME_WRAP_ASYNC_BOF_ADDITIONAL;
+  }
+  *dst++ = IRLAP_FRAME_WRAP_ASYNC_BOF;
+  irlap_wrapper_wrap_async_data(dst, hdr->data, sizeof(hdr->data), &dst);
+  memcpy(dst, wrapped->data, wrapped->len);
+  dst += wrapped->len;
+  crc.crc = irlap_wrapper_prewrapped_fcs(hdr, wrapped);
+  irlap_wrapper_wrap_async_data(dst, crc.data, sizeof(crc.data), &dst);
+  *dst++ = IRLAP_FRAME_WRAP_ASYNC_EOF;
+  return dst - frame_start;
+}
+
+// Stuffed payload is referenced as a single span
+ssize_t irlap_wrapper_wrap_prewrapped_iov(irlap_frame_wrapper_t wrapper, struct iovec* iov, size_t max_iov, struct irlap_wrapper_iov_scratch* scratch, irlap_frame_hdr_t* hdr, struct irlap_wrapped_payload* wrapped, unsigned int num_additional_bof) {
+  union {
+    uint16_t crc;
+    uint8_t data[2];
+  } crc;
+  size_t num_iov = 0;
+  size_t len;
+  uint8_t* trailer;
+
+  if(wrapper != IRLAP_FRAME_WRAPPER_ASYNC || num_additional_bof > IRLAP_FRAME_ADDITIONAL_BOF_MAX) {
+    return -EINVAL;
+  }
+
+  if(!irlap_wrapper_iov_push(iov, max_iov, &num_iov, &irlap_wrapper_async_bofs[IRLAP_FRAME_ADDITIONAL_BOF_MAX - num_additional_bof], num_additional_bof + 1)) {
+    return -ENOBUFS;
+  }
+
+  len = irlap_wrapper_wrap_async_data(scratch->hdr, hdr->data, sizeof(hdr->data), NULL);
+  if(!irlap_wrapper_iov_push(iov, max_iov, &num_iov, scratch->hdr, len)) {
+    return -ENOBUFS;
+  }
+
+  if(wrapped->len && !irlap_wrapper_iov_push(iov, max_iov, &num_iov, wrapped->data, wrapped->len)) {
+    return -ENOBUFS;
+  }
+
+  crc.crc = irlap_wrapper_prewrapped_fcs(hdr, wrapped);
+  len = irlap_wrapper_wrap_async_data(scratch->trailer, crc.data, sizeof(crc.data), &trailer);
+  *trailer = IRLAP_FRAME_WRAP_ASYNC_EOF;
+  len++;
+  if(!irlap_wrapper_iov_push(iov, max_iov, &num_iov, scratch->trailer, len)) {
+    return -ENOBUFS;
+  }
+
+  return num_iov;
+}
+
 static bool irlap_wrapper_check_crc(uint8_t* data, size_t len, size_t* data_len) {
   union {
     uint16_t crc;
@@ -151,23 +389,75 @@ static bool irlap_wrapper_check_crc(uint8_t* data, size_t len, size_t* data_len)
   return !memcmp(crc.data, data + len - sizeof(crc.data), sizeof(crc.data));
 }
 
-static int irlap_wrapper_unwrap_async(irlap_wrapper_state_t* state, uint8_t* data, size_t len, irlap_wrapper_handle_cb_f cb, void* priv) {
+int irlap_wrapper_state_init(irlap_wrapper_state_t* state, size_t size) {
+  memset(state, 0, sizeof(*state));
+#ifdef IRDA_STATIC_ALLOC
+  if(size > sizeof(state->data)) {
+    return -EINVAL;
+  }
+#else
+  state->data = malloc(size);
+  if(!state->data) {
+    return -ENOMEM;
+  }
+#endif
+  state->size = size;
+  atomic_init(&state->pending_size, size);
+  atomic_init(&state->overruns, 0);
+  return 0;
+}
+
+void irlap_wrapper_state_free(irlap_wrapper_state_t* state) {
+#ifndef IRDA_STATIC_ALLOC
+  free(state->data);
+#endif
+}
+
+// May be called from any context, rx buffer is resized once the current frame is done
+void irlap_wrapper_state_resize(irlap_wrapper_state_t* state, size_t size) {
+  atomic_store_explicit(&state->pending_size, size, memory_order_relaxed);
+}
+
+static void irlap_wrapper_state_apply_size(irlap_wrapper_state_t* state) {
+  size_t size = atomic_load_explicit(&state->pending_size, memory_order_relaxed);
+
+  if(size == state->size) {
+    return;
+  }
+#ifdef IRDA_STATIC_ALLOC
+  state->size = min(size, sizeof(state->data));
+#else
+  {
+    uint8_t* data = realloc(state->data, size);
+    // Keep old buffer on failure, oversized frames will be counted as overruns
+    if(data) {
+      state->data = data;
+      state->size = size;
+    }
+  }
+#endif
+}
+
+static int irlap_wrapper_unwrap_async(irlap_wrapper_state_t* state, const uint8_t* data, size_t len, irlap_wrapper_handle_cb_f cb, void* priv) {
   bool busy = false;
   while(len-- > 0) {
     if(IRLAP_FRAME_IS_BOF(*data)) {
       if(state->in_frame && !IRLAP_FRAME_IS_BOF(state->prev_byte)) {
         goto fail;
-      } else {
+      } else if(!state->in_frame) {
+        irlap_wrapper_state_apply_size(state);
+        state->write_ptr = 0;
         state->in_frame = true;
       }
     } else if(IRLAP_FRAME_IS_EOF(*data)) {
       if(state->in_frame) {
         size_t data_len;
         state->in_frame = false;
-        
+
         if(!irlap_wrapper_check_crc(state->data, state->write_ptr, &data_len)) {
           goto fail;
         }
+        state->write_ptr = 0;
         if(cb(state->data, data_len, priv) == IRLAP_ERR_ADDRESS) {
           goto fail;
         }
@@ -177,6 +467,11 @@ static int irlap_wrapper_unwrap_async(irlap_wrapper_state_t* state, uint8_t* dat
         goto fail;
       }
       if(!IRLAP_FRAME_IS_CE(*data)) {
+        if(state->write_ptr >= state->size) {
+          // Drop frame and resync on next BOF
+          atomic_fetch_add_explicit(&state->overruns, 1, memory_order_relaxed);
+          goto fail;
+        }
         state->data[state->write_ptr] = *data;
         if(IRLAP_FRAME_IS_CE(state->prev_byte)) {
           state->data[state->write_ptr] ^= IRLAP_FRAME_WRAP_ASYNC_XOR;
@@ -197,7 +492,7 @@ next:
   return busy;
 }
 
-int irlap_wrapper_unwrap(irlap_frame_wrapper_t wrapper, irlap_wrapper_state_t* state, uint8_t* data, size_t len, irlap_wrapper_handle_cb_f cb, void* priv) {
+int irlap_wrapper_unwrap(irlap_frame_wrapper_t wrapper, irlap_wrapper_state_t* state, const uint8_t* data, size_t len, irlap_wrapper_handle_cb_f cb, void* priv) {
   switch(wrapper) {
     case IRLAP_FRAME_WRAPPER_ASYNC:
       return irlap_wrapper_unwrap_async(state, data, len, cb, priv);
@@ -1,16 +1,33 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "irlap_defs.h"
 
+// Unwrapped size of a frame carrying data_size bytes of information, header and fcs included
+#define IRLAP_WRAPPER_RX_SIZE(data_size) (2 + (data_size) + 2)
+
+#ifdef IRDA_STATIC_ALLOC
+#define IRLAP_WRAPPER_RX_SIZE_STATIC IRLAP_WRAPPER_RX_SIZE(IRLAP_MAX_DATA_SIZE)
+#endif
+
 typedef struct {
   bool in_frame;
   uint8_t prev_byte;
-  uint8_t data[IRLAP_MAX_DATA_SIZE];
+#ifdef IRDA_STATIC_ALLOC
+  uint8_t data[IRLAP_WRAPPER_RX_SIZE_STATIC];
+#else
+  uint8_t* data;
+#endif
+  size_t size;
   off_t write_ptr;
+  // Requested size, applied at the start of the next frame
+  atomic_size_t pending_size;
+  atomic_size_t overruns;
 } irlap_wrapper_state_t;
 
 #include "irlap.h"
@@ -45,4 +62,16 @@ typedef int (*irlap_wrapper_handle_cb_f)(uint8_t* data, size_t len, void * priv)
 
 ssize_t irlap_wrapper_get_wrapped_size(irlap_frame_wrapper_t wrapper, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments, unsigned int num_additional_bof);
 ssize_t irlap_wrapper_wrap(irlap_frame_wrapper_t wrapper, uint8_t* dst, size_t dst_len, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments, unsigned int num_additional_bof);
-int irlap_wrapper_unwrap(irlap_frame_wrapper_t wrapper, irlap_wrapper_state_t* state, uint8_t* data, size_t len, irlap_wrapper_handle_cb_f cb, void* priv);
+ssize_t irlap_wrapper_wrap_iov(irlap_frame_wrapper_t wrapper, struct iovec* iov, size_t max_iov, struct irlap_wrapper_iov_scratch* scratch, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments, unsigned int num_additional_bof);
+ssize_t irlap_wrapper_prewrap(irlap_frame_wrapper_t wrapper, struct irlap_wrapped_payload* wrapped, uint8_t* dst, size_t dst_len, irlap_frame_hdr_t* hdr, uint8_t* data, size_t len, bool reference);
+ssize_t irlap_wrapper_get_prewrapped_size(irlap_frame_wrapper_t wrapper, irlap_frame_hdr_t* hdr, struct irlap_wrapped_payload* wrapped, unsigned int num_additional_bof);
+ssize_t irlap_wrapper_wrap_prewrapped(irlap_frame_wrapper_t wrapper, uint8_t* dst, size_t dst_len, irlap_frame_hdr_t* hdr, struct irlap_wrapped_payload* wrapped, unsigned int num_additional_bof);
+ssize_t irlap_wrapper_wrap_prewrapped_iov(irlap_frame_wrapper_t wrapper, struct iovec* iov, size_t max_iov, struct irlap_wrapper_iov_scratch* scratch, irlap_frame_hdr_t* hdr, struct irlap_wrapped_payload* wrapped, unsigned int num_additional_bof);
+int irlap_wrapper_state_init(irlap_wrapper_state_t* state, size_t size);
+void irlap_wrapper_state_free(irlap_wrapper_state_t* state);
+void irlap_wrapper_state_resize(irlap_wrapper_state_t* state, size_t size);
+int irlap_wrapper_unwrap(irlap_frame_wrapper_t wrapper, irlap_wrapper_state_t* state, const uint8_t* data, size_t len, irlap_wrapper_handle_cb_f cb, void* priv);
+
+static inline size_t irlap_wrapper_get_overruns(irlap_wrapper_state_t* state) {
+  return atomic_load_explicit(&state->overruns, memory_order_relaxed);
+}
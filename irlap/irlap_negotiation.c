@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "irlap_negotiation.h"
 
@@ -49,12 +50,13 @@ static ssize_t populate_param(uint8_t* data, size_t len, irlap_negotiation_param
     return -ENOBUFS;
   }
   if(param->populate) {
-    return param->update(params, data, len);
+    return param->populate(data, len, params);
   }
   *data = params->params[param->param_idx] & param->param_mask;
   return 1;
 }
 
+// Ordered by param_idx
 static struct irlap_negotiation_param negotiation_params[] = {
   { 0x01, 1, 2, 0, 0, update_baudrate, populate_baudrate },
   { 0x82, 1, 1, 1, 0b00001111, NULL, NULL },
@@ -66,26 +68,30 @@ static struct irlap_negotiation_param negotiation_params[] = {
   { 0x00, 0, 0, 0, 0, NULL, NULL },
 };
 
+// Parameter id to index into negotiation_params plus one, 0 for unknown ids
+static const uint8_t param_lut[256] = {
+  [0x01] = 1,
+  [0x82] = 2,
+  [0x83] = 3,
+  [0x84] = 4,
+  [0x85] = 5,
+  [0x86] = 6,
+  [0x08] = 7,
+};
+
 static struct irlap_negotiation_param* get_param_by_id(uint8_t id) {
-  struct irlap_negotiation_param* param = negotiation_params;
-  while(param->max_len != 0) {
-    if(param->param_id == id) {
-      return param;
-    }
-    param++;
+  uint8_t idx = param_lut[id];
+  if(!idx) {
+    return NULL;
   }
-  return NULL;
+  return &negotiation_params[idx - 1];
 }
 
 static struct irlap_negotiation_param* get_param_by_index(uint8_t idx) {
-  struct irlap_negotiation_param* param = negotiation_params;
-  while(param->max_len != 0) {
-    if(param->param_idx == idx) {
-      return param;
-    }
-    param++;
+  if(idx >= ARRAY_LEN(negotiation_params) - 1) {
+    return NULL;
   }
-  return NULL;
+  return &negotiation_params[idx];
 }
 
 ssize_t irlap_negotiation_update_params(irlap_negotiation_params_t* params, uint8_t* data, size_t len) {
@@ -103,7 +109,7 @@ ssize_t irlap_negotiation_update_params(irlap_negotiation_params_t* params, uint
     }
     param = get_param_by_id(param_id);
     if(param) {
-      int err = update_param(params, param, data, len);
+      int err = update_param(params, param, data, param_len);
       if(err) {
         return err;
       }
@@ -124,12 +130,22 @@ ssize_t irlap_negotiation_populate_params(uint8_t* data, size_t len, irlap_negot
     if(!param) {
       continue;
     }
-    err = populate_param(data, len, params, param);
+    // Parameter identifier and length go in front of the value
+    if(len < 2) {
+      return -ENOBUFS;
+    }
+    err = populate_param(data + 2, len - 2, params, param);
     if(err < 0) {
       return err;
     }
-    len_populated += err;
-    data += err;
+    if(err == 0) {
+      continue;
+    }
+    data[0] = param->param_id;
+    data[1] = (uint8_t)err;
+    len_populated += 2 + err;
+    data += 2 + err;
+    len -= 2 + err;
   }
   return len_populated;
 }
@@ -140,6 +156,7 @@ static irlap_negotiation_param_t get_most_significant_set_bit(irlap_negotiation_
     if(val & mask) {
       return val & mask;
     }
+    mask >>= 1;
   }
   return IRLAP_NEGOTIATION_PARAM_UNSET;
 }
@@ -248,18 +265,25 @@ static inline uint8_t additional_bofs_bits_to_value(irlap_negotiation_param_t bi
   switch(bits) {
     case IRLAP_NEGOTIATION_ADDITIONAL_BOFS_48:
       raw_bofs = 48;
+      break;
     case IRLAP_NEGOTIATION_ADDITIONAL_BOFS_24:
       raw_bofs = 24;
+      break;
     case IRLAP_NEGOTIATION_ADDITIONAL_BOFS_12:
       raw_bofs = 12;
+      break;
     case IRLAP_NEGOTIATION_ADDITIONAL_BOFS_5:
       raw_bofs = 5;
+      break;
     case IRLAP_NEGOTIATION_ADDITIONAL_BOFS_3:
       raw_bofs = 3;
+      break;
     case IRLAP_NEGOTIATION_ADDITIONAL_BOFS_2:
       raw_bofs = 2;
+      break;
     case IRLAP_NEGOTIATION_ADDITIONAL_BOFS_1:
       raw_bofs = 1;
+      break;
     case IRLAP_NEGOTIATION_ADDITIONAL_BOFS_0:
       return 0;
     default:
@@ -350,32 +374,131 @@ static uint32_t get_max_line_capacity(uint32_t baudrate, uint16_t max_turn_aroun
   return 0;
 }
 
-static inline uint16_t get_requested_line_capacity(irlap_negotiation_values_t* values) {
-  uint16_t turn_around_bytes = (uint16_t)((uint64_t)values->baudrate * 1000000ULL / (uint64_t)values->min_turn_around_time_us);
-  return (uint16_t)values->window_size * (values->data_size + 6 + (uint16_t)values->additional_bofs) + turn_around_bytes;
+// Bytes that could have been sent while waiting for the remote to turn the link around
+static inline uint32_t get_turn_around_bytes(uint32_t baudrate, uint16_t min_turn_around_time_us) {
+  return (uint32_t)((uint64_t)baudrate / 10 * min_turn_around_time_us / 1000000ULL);
 }
 
+static inline uint32_t get_frame_overhead(irlap_negotiation_values_t* values) {
+  return IRLAP_NEGOTIATION_FRAME_OVERHEAD + values->additional_bofs;
+}
+
+// Largest window that fits into the line capacity, 0 if not even a single frame fits
+static uint8_t get_max_window_size(irlap_negotiation_values_t* values, uint32_t line_capacity, uint16_t data_size, uint8_t max_window_size) {
+  uint32_t turn_around_bytes = get_turn_around_bytes(values->baudrate, values->min_turn_around_time_us);
+  uint32_t window_size;
+
+  if(line_capacity <= turn_around_bytes) {
+    return 0;
+  }
+  window_size = (line_capacity - turn_around_bytes) / (data_size + get_frame_overhead(values));
+  return min(window_size, max_window_size);
+}
+
+// Largest data size that fits a single frame, window size is then filled up for that data size.
+// Receivers must be prepared for this, no matter what the sender ends up choosing
 static int fit_line_capacity(irlap_negotiation_values_t* values) {
-  bool reduce_window_size = true;
   uint32_t max_line_capacity = get_max_line_capacity(values->baudrate, values->max_turn_around_time_ms);
+  uint8_t window_size;
+
   if(max_line_capacity == 0) {
     return -EINVAL;
   }
-  while(get_requested_line_capacity(values) > max_line_capacity) {
-    if(values->data_size <= 64 && values->window_size <= 1) {
+  while(!get_max_window_size(values, max_line_capacity, values->data_size, 1)) {
+    if(values->data_size <= IRLAP_NEGOTIATION_DATA_SIZE_MIN) {
       return -EINVAL;
     }
-    if(reduce_window_size) {
-      if(values->window_size > 1) {
-        values->window_size--;
+    values->data_size /= 2;
+  }
+  window_size = get_max_window_size(values, max_line_capacity, values->data_size, values->window_size);
+  values->window_size = window_size;
+  return 0;
+}
+
+// Probability of a frame of len bytes making it through, Q32 fixed point
+static uint64_t get_frame_success_probability(uint32_t bit_error_rate_ppb, uint32_t len) {
+  uint64_t base;
+  uint64_t res = 1ULL << 32;
+  uint32_t bits = len * 8;
+
+  if(bit_error_rate_ppb == 0) {
+    return res;
+  }
+  if(bit_error_rate_ppb >= IRLAP_NEGOTIATION_BER_SCALE) {
+    return 0;
+  }
+  base = ((uint64_t)(IRLAP_NEGOTIATION_BER_SCALE - bit_error_rate_ppb) << 32) / IRLAP_NEGOTIATION_BER_SCALE;
+  // Exponentiation by squaring, values stay below 2^32 so products fit 64 bits
+  while(bits) {
+    if(bits & 1) {
+      res = (res * base) >> 32;
+    }
+    base = (base * base) >> 32;
+    bits >>= 1;
+  }
+  return res;
+}
+
+// Expected payload bytes delivered per second, scaled arbitrarily. Every turn costs the remote's
+// answer and two min turn around times on top of the window itself
+static uint64_t get_goodput_score(irlap_negotiation_values_t* values, uint8_t window_size, uint16_t data_size, uint32_t bit_error_rate_ppb) {
+  uint32_t overhead = get_frame_overhead(values);
+  uint64_t turn_bytes = (uint64_t)window_size * (data_size + overhead) + overhead;
+  uint64_t turn_time_us = turn_bytes * 10ULL * 1000000ULL / values->baudrate + 2ULL * values->min_turn_around_time_us;
+  uint64_t success = get_frame_success_probability(bit_error_rate_ppb, data_size + overhead);
+
+  if(!turn_time_us) {
+    return 0;
+  }
+  return (uint64_t)window_size * data_size * (success >> 8) * 1024ULL / turn_time_us;
+}
+
+int irlap_negotiation_solve_tx_values(irlap_negotiation_values_t* values, uint32_t bit_error_rate_ppb) {
+  static const uint16_t turn_around_times_ms[] = { 50, 100, 250, 500 };
+  uint16_t best_data_size = 0;
+  uint16_t best_turn_around_time_ms = 0;
+  uint8_t best_window_size = 0;
+  uint64_t best_score = 0;
+  unsigned int i;
+
+  // Goodput grows with the window size for any fixed data size, the largest window fitting the
+  // line capacity is optimal. That leaves only turn around time and data size to search
+  for(i = 0; i < ARRAY_LEN(turn_around_times_ms); i++) {
+    uint16_t turn_around_time_ms = turn_around_times_ms[i];
+    uint32_t line_capacity;
+    uint16_t data_size;
+
+    if(turn_around_time_ms > values->max_turn_around_time_ms) {
+      break;
+    }
+    if(values->baudrate < 115200 && turn_around_time_ms != 500) {
+      continue;
+    }
+    line_capacity = get_max_line_capacity(values->baudrate, turn_around_time_ms);
+    for(data_size = IRLAP_NEGOTIATION_DATA_SIZE_MIN; data_size <= values->data_size; data_size *= 2) {
+      uint8_t window_size = get_max_window_size(values, line_capacity, data_size, values->window_size);
+      uint64_t score;
+
+      if(!window_size) {
+        break;
       }
-    } else {
-      if(values->data_size > 64) {
-        values->data_size /= 2;
+      // Strictly better only, shorter turn around times recover faster from lost frames
+      score = get_goodput_score(values, window_size, data_size, bit_error_rate_ppb);
+      if(score > best_score || !best_window_size) {
+        best_score = score;
+        best_window_size = window_size;
+        best_data_size = data_size;
+        best_turn_around_time_ms = turn_around_time_ms;
       }
     }
-    reduce_window_size = !reduce_window_size;
   }
+
+  if(!best_window_size) {
+    return -EINVAL;
+  }
+  values->window_size = best_window_size;
+  values->data_size = best_data_size;
+  values->max_turn_around_time_ms = best_turn_around_time_ms;
   return 0;
 }
 
@@ -409,25 +532,51 @@ int irlap_negotiation_translate_params_to_values(irlap_negotiation_values_t* val
     return -EINVAL;
   }
 
-  if(values->baudrate < 115200 && values->max_turn_around_time_ms != 500) {
-    return -EINVAL;
+  // Only 500ms are permitted below 115200 baud
+  if(values->baudrate < 115200) {
+    values->max_turn_around_time_ms = 500;
   }
 
   return fit_line_capacity(values);
 }
 
+// Set all bits up to and including the most significant one
 static irlap_negotiation_param_t fill_bits(irlap_negotiation_param_t val) {
-  irlap_negotiation_param_t mask = 1 << IRLAP_NEGOTIATION_PARAM_MSB;
-  irlap_negotiation_param_t fill = 0;
-  while(mask > 0) {
-    if(val & mask) {
-      fill = mask;
+  irlap_negotiation_param_t msb = get_most_significant_set_bit(val);
+  if(msb == IRLAP_NEGOTIATION_PARAM_UNSET) {
+    return IRLAP_NEGOTIATION_PARAM_UNSET;
+  }
+  return msb | (msb - 1);
+}
+
+// Clear all bits standing for values above the limit, limits of 0 leave a parameter untouched
+int irlap_negotiation_limit_params(irlap_negotiation_params_t* params, irlap_negotiation_values_t* limits) {
+  irlap_negotiation_param_t bit;
+  unsigned int i;
+
+  for(i = 0; i <= IRLAP_NEGOTIATION_PARAM_MSB; i++) {
+    bit = 1 << i;
+    if(limits->baudrate && baudrate_bits_to_value(bit) > limits->baudrate) {
+      params->baudrate &= ~bit;
     }
-    val |= fill;
-    fill <<= 1;
-    mask <<= 1;
+    if(limits->max_turn_around_time_ms && max_turn_around_time_bits_to_value(bit) > limits->max_turn_around_time_ms) {
+      params->max_turn_around_time &= ~bit;
+    }
+    if(limits->data_size && data_size_bits_to_value(bit) > limits->data_size) {
+      params->data_size &= ~bit;
+    }
+    if(limits->disconnect_threshold_time_s && disconnect_threshold_bits_to_value(bit) > limits->disconnect_threshold_time_s) {
+      params->disconnect_threshold &= ~bit;
+    }
+  }
+
+  if(params->baudrate == IRLAP_NEGOTIATION_PARAM_UNSET ||
+     params->max_turn_around_time == IRLAP_NEGOTIATION_PARAM_UNSET ||
+     params->data_size == IRLAP_NEGOTIATION_PARAM_UNSET ||
+     params->disconnect_threshold == IRLAP_NEGOTIATION_PARAM_UNSET) {
+    return -IRLAP_ERR_NO_COMMON_PARAMETERS_FOUND;
   }
-  return val;
+  return 0;
 }
 
 void irlap_negotiation_load_default_params(irlap_negotiation_params_t* params) {
@@ -474,7 +623,7 @@ static irlap_negotiation_param_t data_size_value_to_bits(irlap_negotiation_value
 }
 
 static irlap_negotiation_param_t window_size_value_to_bits(irlap_negotiation_values_t* values) {
-  uint16_t window_size = values->data_size;
+  uint16_t window_size = values->window_size;
   irlap_negotiation_param_t param = 1;
   while(param & IRLAP_NEGOTIATION_WINDOW_SIZE_MASK) {
     if(window_size == 1) {
@@ -580,3 +729,67 @@ int irlap_negotiation_translate_values_to_params(irlap_negotiation_params_t* par
   }
   return 0;
 }
+
+// Cache the serialized default parameter block, it only changes with the phy capabilities
+int irlap_negotiation_context_update(struct irlap_negotiation_context* ctx, irlap_negotiation_values_t* values, uint16_t baudrates) {
+  ssize_t block_len;
+  int err;
+
+  if(ctx->valid && ctx->baudrates == baudrates) {
+    return 0;
+  }
+
+  ctx->valid = false;
+  err = irlap_negotiation_translate_values_to_params(&ctx->params, values, baudrates);
+  if(err) {
+    return err;
+  }
+  block_len = irlap_negotiation_populate_params(ctx->block, sizeof(ctx->block), &ctx->params);
+  if(block_len < 0) {
+    return block_len;
+  }
+  ctx->block_len = block_len;
+  ctx->baudrates = baudrates;
+  ctx->valid = true;
+  return 0;
+}
+
+// Default parameters are copied from the cache, anything else is serialized
+ssize_t irlap_negotiation_context_populate_params(struct irlap_negotiation_context* ctx, uint8_t* data, size_t len, irlap_negotiation_params_t* params) {
+  if(ctx->valid && !memcmp(params, &ctx->params, sizeof(*params))) {
+    if(len < ctx->block_len) {
+      return -ENOBUFS;
+    }
+    memcpy(data, ctx->block, ctx->block_len);
+    return ctx->block_len;
+  }
+  return irlap_negotiation_populate_params(data, len, params);
+}
+
+// Baudrates is a bitmap of IRLAP_NEGOTIATION_BAUDRATE_* bits
+bool irlap_negotiation_baudrate_is_supported(uint32_t baudrate, uint16_t baudrates) {
+  unsigned int i;
+
+  for(i = 0; i <= IRLAP_NEGOTIATION_PARAM_MSB; i++) {
+    if((baudrates & (1 << i)) && baudrate_bits_to_value(1 << i) == baudrate) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Neighbouring standard baudrate, 0 if there is none
+uint32_t irlap_negotiation_get_next_baudrate(uint32_t baudrate, bool higher) {
+  unsigned int i;
+
+  for(i = 0; i <= IRLAP_NEGOTIATION_PARAM_MSB; i++) {
+    if(baudrate_bits_to_value(1 << i) != baudrate) {
+      continue;
+    }
+    if(higher) {
+      return i < IRLAP_NEGOTIATION_PARAM_MSB ? baudrate_bits_to_value(1 << (i + 1)) : 0;
+    }
+    return i > 0 ? baudrate_bits_to_value(1 << (i - 1)) : 0;
+  }
+  return 0;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -76,6 +77,12 @@ typedef uint16_t irlap_negotiation_param_t;
 #define IRLAP_NEGOTIATION_DISCONNECT_THRESHOLD_TIME_30_S 0b01000000
 #define IRLAP_NEGOTIATION_DISCONNECT_THRESHOLD_TIME_40_S 0b10000000
 
+#define IRLAP_NEGOTIATION_DATA_SIZE_MIN 64
+// Address, control, fcs, bof and eof
+#define IRLAP_NEGOTIATION_FRAME_OVERHEAD 6
+// Bit error rates are given in parts per billion
+#define IRLAP_NEGOTIATION_BER_SCALE 1000000000UL
+
 #define IRLAP_NEGOTIATION_PARAM_MSB (sizeof(irlap_negotiation_param_t) * 8 - 1)
 #define IRLAP_NEGOTIATION_NUM_PARAMS (ARRAY_LEN(((irlap_negotiation_params_t*)NULL)->params))
 
@@ -124,10 +131,27 @@ struct irlap_negotiation_values {
 
 typedef struct irlap_negotiation_values irlap_negotiation_values_t;
 
+#define IRLAP_NEGOTIATION_PARAMETERS_MAX_LEN 22
+
+// Default local parameters, built once per set of phy capabilities
+struct irlap_negotiation_context {
+  bool valid;
+  uint16_t baudrates;
+  irlap_negotiation_params_t params;
+  uint8_t block[IRLAP_NEGOTIATION_PARAMETERS_MAX_LEN];
+  size_t block_len;
+};
+
 ssize_t irlap_negotiation_update_params(irlap_negotiation_params_t* params, uint8_t* data, size_t len);
 ssize_t irlap_negotiation_populate_params(uint8_t* data, size_t len, irlap_negotiation_params_t* params);
 int irlap_negotiation_merge_params(irlap_negotiation_params_t* a, irlap_negotiation_params_t* b);
 int irlap_negotiation_translate_params_to_values(irlap_negotiation_values_t* values, irlap_negotiation_params_t* params);
+int irlap_negotiation_solve_tx_values(irlap_negotiation_values_t* values, uint32_t bit_error_rate_ppb);
+int irlap_negotiation_limit_params(irlap_negotiation_params_t* params, irlap_negotiation_values_t* limits);
+int irlap_negotiation_context_update(struct irlap_negotiation_context* ctx, irlap_negotiation_values_t* values, uint16_t baudrates);
+ssize_t irlap_negotiation_context_populate_params(struct irlap_negotiation_context* ctx, uint8_t* data, size_t len, irlap_negotiation_params_t* params);
+uint32_t irlap_negotiation_get_next_baudrate(uint32_t baudrate, bool higher);
+bool irlap_negotiation_baudrate_is_supported(uint32_t baudrate, uint16_t baudrates);
 void irlap_negotiation_load_default_params(irlap_negotiation_params_t* params);
 void irlap_negotiation_load_default_values(irlap_negotiation_values_t* values);
 int irlap_negotiation_translate_values_to_params(irlap_negotiation_params_t* params, irlap_negotiation_values_t* values, uint16_t baudrates);
@@ -0,0 +1,229 @@
+#include "irlap_poll.h"
+#include "irlap.h"
+#include "irlap_connection.h"
+
+#define LOCAL_TAG "IRDA LAP POLL"
+
+#define IRLAP_POLL_LOGV(lap, fmt, ...) IRHAL_LOGV((lap)->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_POLL_LOGD(lap, fmt, ...) IRHAL_LOGD((lap)->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_POLL_LOGI(lap, fmt, ...) IRHAL_LOGI((lap)->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_POLL_LOGW(lap, fmt, ...) IRHAL_LOGW((lap)->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_POLL_LOGE(lap, fmt, ...) IRHAL_LOGE((lap)->phy->hal, fmt, ##__VA_ARGS__)
+
+void irlap_poll_init(struct irlap_poll_state* poll) {
+  poll->timer = IRHAL_TIMER_INVALID;
+  poll->interval_max_ms = IRLAP_POLL_IDLE_INTERVAL_MAX_MS;
+}
+
+// Drop a delayed poll, caller must hold the connection state lock
+void irlap_poll_cancel(struct irlap_connection* conn) {
+  if(conn->poll.timer >= 0) {
+    irlap_clear_timer(conn->lap, conn->poll.timer);
+    conn->poll.timer = IRHAL_TIMER_INVALID;
+  }
+}
+
+// Limit for stretching the poll interval of an idle connection, 0 polls at full speed
+int irlap_poll_set_idle_interval(struct irlap* lap, irlap_connection_addr_t hndl, unsigned int interval_max_ms) {
+  struct irlap_connection* conn;
+  int err = 0;
+
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  conn = irlap_connection_get(lap, hndl);
+  if(!conn) {
+    err = -IRLAP_ERR_NO_CONNECTION;
+    goto out_connections_locked;
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  conn->poll.interval_max_ms = interval_max_ms;
+  conn->poll.interval_ms = min(conn->poll.interval_ms, interval_max_ms);
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+
+out_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  return err;
+}
+
+// Bytes the primary can send in one turn without exceeding the negotiated max turn around time
+size_t irlap_poll_get_quantum(struct irlap_connection* conn) {
+  uint32_t baudrate = irlap_connection_get_baudrate(conn);
+  unsigned int turnaround_ms = conn->local_negotiation_values.max_turn_around_time_ms;
+  // Async wrapping takes 10 bit times per byte
+  return (size_t)baudrate / 10 * turnaround_ms / 1000;
+}
+
+static bool irlap_poll_has_tx_data(struct irlap_connection* conn) {
+  struct irlap_data* idata = &conn->data;
+  return irlap_data_has_queued(idata) || idata->va != idata->vs || idata->srej_requested;
+}
+
+// Account the turn the secondary just finished, caller must hold the connection state lock
+void irlap_poll_update(struct irlap_connection* conn) {
+  struct irlap_poll_state* poll = &conn->poll;
+  unsigned int interval_max_ms;
+
+  if(conn->data.rx_turn || conn->data.rx_unitdata || irlap_poll_has_tx_data(conn)) {
+    poll->idle_rounds = 0;
+    poll->skip = 0;
+    poll->interval_ms = 0;
+    return;
+  }
+
+  if(poll->idle_rounds < IRLAP_POLL_IDLE_SHIFT_MAX) {
+    poll->idle_rounds++;
+  }
+  // Half the disconnect threshold is the latest an idle secondary gets polled anyway
+  interval_max_ms = min(poll->interval_max_ms, (unsigned int)conn->local_negotiation_values.disconnect_threshold_time_s * 1000 / 2);
+  if(!poll->interval_ms) {
+    poll->interval_ms = IRLAP_POLL_IDLE_INTERVAL_MIN_MS;
+  } else {
+    poll->interval_ms *= 2;
+  }
+  poll->interval_ms = min(poll->interval_ms, interval_max_ms);
+}
+
+// Secondaries disconnect if not polled within the disconnect threshold, leave plenty of margin
+static bool irlap_poll_is_overdue(struct irlap_connection* conn, const time_ns_t* now) {
+  time_ns_t since = *now;
+  time_sub(&since, &conn->poll.last_poll);
+  return time_to_ns(&since) >= (uint64_t)conn->local_negotiation_values.disconnect_threshold_time_s * TIME_NSEC_PER_SEC / 2;
+}
+
+// Pick the connection to poll after served, which may be NULL. Caller must hold the connection lock
+struct irlap_connection* irlap_poll_next(struct irlap* lap, struct irlap_connection* served) {
+  struct list_head* start = served ? &served->list : &lap->connections;
+  struct list_head* cursor = start;
+  struct irlap_connection* next = NULL;
+  struct irlap_connection* fallback = NULL;
+  time_ns_t now;
+
+  irhal_now(lap->phy->hal, &now);
+  // Round robin starting after served, served itself is considered last
+  do {
+    struct irlap_connection* conn;
+    cursor = cursor->next;
+    if(cursor == &lap->connections) {
+      continue;
+    }
+    conn = LIST_GET_ENTRY(cursor, struct irlap_connection, list);
+    if(!IRLAP_CONNECTION_IS_NEGOTIATED(conn)) {
+      continue;
+    }
+
+    irlap_lock_take_reentrant(lap, conn->state_lock);
+    if(!conn->poll.idle_rounds || !conn->poll.skip || irlap_poll_has_tx_data(conn) || irlap_poll_is_overdue(conn, &now)) {
+      next = conn;
+    } else {
+      conn->poll.skip--;
+      if(!fallback || conn->poll.skip < fallback->poll.skip) {
+        fallback = conn;
+      }
+    }
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+  } while(!next && cursor != start);
+
+  // Everybody is idle, poll whoever is closest to being due
+  if(!next) {
+    next = fallback;
+  }
+  if(!next) {
+    return NULL;
+  }
+
+  irlap_lock_take_reentrant(lap, next->state_lock);
+  if(irlap_poll_has_tx_data(next)) {
+    next->poll.deficit += irlap_poll_get_quantum(next);
+  } else if(next->poll.idle_rounds) {
+    // Back off exponentially from idle secondaries
+    next->poll.skip = (1U << next->poll.idle_rounds) - 1;
+  }
+  next->poll.last_poll = now;
+  IRLAP_POLL_LOGV(lap, "Polling connection %u, deficit %zu bytes, idle for %u turns", next->connection_addr, next->poll.deficit, next->poll.idle_rounds);
+  irlap_lock_put_reentrant(lap, next->state_lock);
+  return next;
+}
+
+static void irlap_poll_timeout(void* priv) {
+  struct irlap_connection* conn = priv;
+  struct irlap* lap = conn->lap;
+
+  irlap_lock_take_reentrant(lap, lap->state_lock);
+  irlap_lock_take_reentrant(lap, lap->connection_lock);
+  if(irlap_connection_get(lap, conn->connection_addr) != conn) {
+    goto out_connections_locked;
+  }
+
+  irlap_lock_take_reentrant(lap, conn->state_lock);
+  // Kicked while this timeout was waiting for the locks, the poll went out already
+  if(conn->poll.timer < 0) {
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+    goto out_connections_locked;
+  }
+  conn->poll.timer = IRHAL_TIMER_INVALID;
+  irlap_lock_put_reentrant(lap, conn->state_lock);
+  irlap_data_send_turn(conn);
+
+out_connections_locked:
+  irlap_lock_put_reentrant(lap, lap->connection_lock);
+  irlap_lock_put_reentrant(lap, lap->state_lock);
+}
+
+// Hold back the poll of next while every connection is idle. Returns true if the turn
+// will be sent from the poll timer. Caller must hold the connection lock
+bool irlap_poll_defer(struct irlap* lap, struct irlap_connection* next) {
+  struct list_head* cursor;
+  unsigned int interval_ms;
+  int timer;
+
+  LIST_FOR_EACH(cursor, &lap->connections) {
+    struct irlap_connection* conn = LIST_GET_ENTRY(cursor, struct irlap_connection, list);
+    bool active;
+    if(!IRLAP_CONNECTION_IS_NEGOTIATED(conn)) {
+      continue;
+    }
+    irlap_lock_take_reentrant(lap, conn->state_lock);
+    active = !conn->poll.idle_rounds || irlap_poll_has_tx_data(conn);
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+    if(active) {
+      return false;
+    }
+  }
+
+  irlap_lock_take_reentrant(lap, next->state_lock);
+  interval_ms = next->poll.interval_ms;
+  if(!interval_ms) {
+    irlap_lock_put_reentrant(lap, next->state_lock);
+    return false;
+  }
+  timer = irlap_set_timer(lap, interval_ms, irlap_poll_timeout, next);
+  if(timer < 0) {
+    IRLAP_POLL_LOGW(lap, "Failed to start poll timer, polling right away: %d", timer);
+    irlap_lock_put_reentrant(lap, next->state_lock);
+    return false;
+  }
+  irlap_poll_cancel(next);
+  next->poll.timer = timer;
+  IRLAP_POLL_LOGV(lap, "Delaying poll of idle connection %u by %u ms", next->connection_addr, interval_ms);
+  irlap_lock_put_reentrant(lap, next->state_lock);
+  return true;
+}
+
+// New data to send ends the idle delay, the pending poll goes out right away.
+// Caller must hold the connection lock
+void irlap_poll_kick(struct irlap* lap) {
+  struct list_head* cursor;
+
+  LIST_FOR_EACH(cursor, &lap->connections) {
+    struct irlap_connection* conn = LIST_GET_ENTRY(cursor, struct irlap_connection, list);
+    bool pending;
+    irlap_lock_take_reentrant(lap, conn->state_lock);
+    pending = conn->poll.timer >= 0;
+    irlap_poll_cancel(conn);
+    irlap_lock_put_reentrant(lap, conn->state_lock);
+    if(pending) {
+      irlap_data_send_turn(conn);
+      return;
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "irlap_defs.h"
+#include "../util/time.h"
+
+struct irlap;
+struct irlap_connection;
+
+// Idle secondaries are skipped for up to 2^IRLAP_POLL_IDLE_SHIFT_MAX - 1 scheduling passes
+#define IRLAP_POLL_IDLE_SHIFT_MAX 3
+
+// Idle secondaries are polled after a delay, doubled on every idle turn starting from
+// IRLAP_POLL_IDLE_INTERVAL_MIN_MS, up to the per connection limit
+#define IRLAP_POLL_IDLE_INTERVAL_MIN_MS 10
+#ifndef IRLAP_POLL_IDLE_INTERVAL_MAX_MS
+#define IRLAP_POLL_IDLE_INTERVAL_MAX_MS 1000
+#endif
+
+// Per connection state of the primary's deficit round robin poll scheduler
+struct irlap_poll_state {
+  // Bytes of I frames the next turn may carry
+  size_t deficit;
+  // Consecutive turns without data in either direction
+  unsigned int idle_rounds;
+  unsigned int skip;
+  time_ns_t last_poll;
+  // Pending delayed poll
+  int timer;
+  unsigned int interval_ms;
+  unsigned int interval_max_ms;
+};
+
+void irlap_poll_init(struct irlap_poll_state* poll);
+void irlap_poll_cancel(struct irlap_connection* conn);
+int irlap_poll_set_idle_interval(struct irlap* lap, irlap_connection_addr_t hndl, unsigned int interval_max_ms);
+size_t irlap_poll_get_quantum(struct irlap_connection* conn);
+void irlap_poll_update(struct irlap_connection* conn);
+struct irlap_connection* irlap_poll_next(struct irlap* lap, struct irlap_connection* served);
+bool irlap_poll_defer(struct irlap* lap, struct irlap_connection* next);
+void irlap_poll_kick(struct irlap* lap);
@@ -26,9 +26,14 @@ int irlap_test_request(struct irlap* lap, irlap_connection_addr_t conn_addr, irl
     { payload, payload_len },
   };
 
+  if(payload_len > IRLAP_TX_REQUEST_DATA_SIZE - IRLAP_TEST_FRAME_LEN) {
+    IRLAP_TEST_LOGW(lap, "Overly long test request with %zu bytes", payload_len);
+    return -IRLAP_ERR_DATA_TOO_LONG;
+  }
+
   irlap_lock_take_reentrant(lap, lap->state_lock);
   frame.src_address = irlap_get_address(lap);
-  switch(lap->state) {
+  switch(irlap_get_state(lap)) {
     case IRLAP_STATION_MODE_NDM:
       if(irlap_is_media_busy(lap)) {
         IRLAP_TEST_LOGD(lap, "Media busy, can't send test cmd");
@@ -102,7 +107,7 @@ int irlap_test_handle_test_cmd(struct irlap* lap, struct irlap_connection* conn,
   }
 
   irlap_lock_take_reentrant(lap, lap->state_lock);
-  switch(lap->state) {
+  switch(irlap_get_state(lap)) {
     case IRLAP_STATION_MODE_NDM:
       err = handle_test_cmd_ndm(lap, &frame, data, len);
       break;
@@ -135,8 +140,7 @@ int irlap_test_handle_test_resp(struct irlap* lap, struct irlap_connection* conn
     return err;
   }
 
-  irlap_lock_take_reentrant(lap, lap->state_lock);
-  switch(lap->state) {
+  switch(irlap_get_state(lap)) {
     case IRLAP_STATION_MODE_NDM:
       err = handle_test_resp_ndm(lap, &frame, data, len);
       break;
@@ -144,6 +148,5 @@ int irlap_test_handle_test_resp(struct irlap* lap, struct irlap_connection* conn
       IRLAP_TEST_LOGD(lap, "Not in NDM state, can't respond to test cmd");
       err = -IRLAP_ERR_STATION_STATE;
   }
-  irlap_lock_put_reentrant(lap, lap->state_lock);
   return err;
 }
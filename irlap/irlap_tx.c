@@ -0,0 +1,284 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "irlap.h"
+#include "irlap_tx.h"
+
+#define IRLAP_TX_TO_IRLAP(txq) (container_of((txq), struct irlap, tx))
+
+#define LOCAL_TAG "IRDA LAP TX"
+
+#define IRLAP_TX_LOGV(txq, fmt, ...) IRHAL_LOGV(IRLAP_TX_TO_IRLAP(txq)->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_TX_LOGD(txq, fmt, ...) IRHAL_LOGD(IRLAP_TX_TO_IRLAP(txq)->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_TX_LOGI(txq, fmt, ...) IRHAL_LOGI(IRLAP_TX_TO_IRLAP(txq)->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_TX_LOGW(txq, fmt, ...) IRHAL_LOGW(IRLAP_TX_TO_IRLAP(txq)->phy->hal, fmt, ##__VA_ARGS__)
+#define IRLAP_TX_LOGE(txq, fmt, ...) IRHAL_LOGE(IRLAP_TX_TO_IRLAP(txq)->phy->hal, fmt, ##__VA_ARGS__)
+
+int irlap_tx_init(struct irlap_tx_queue* txq) {
+  struct irlap* lap = IRLAP_TX_TO_IRLAP(txq);
+  int err;
+
+  memset(txq, 0, sizeof(*txq));
+  INIT_LIST_HEAD(txq->pending);
+  err = irlap_lock_alloc(lap, &txq->lock);
+  if(err) {
+    IRLAP_TX_LOGE(txq, "Failed to allocate tx queue lock");
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  return err;
+}
+
+static void irlap_tx_request_put(struct irlap* lap, struct irlap_tx_request* req) {
+  if(req->ref) {
+    irlap_data_buffer_put(req->ref);
+  }
+  objpool_put(&lap->pools.frames, req);
+}
+
+void irlap_tx_free(struct irlap_tx_queue* txq) {
+  struct irlap* lap = IRLAP_TX_TO_IRLAP(txq);
+  struct list_head *cursor, *next;
+  LIST_FOR_EACH_SAFE(cursor, next, &txq->pending) {
+    struct irlap_tx_request* req = LIST_GET_ENTRY(cursor, struct irlap_tx_request, list);
+    irlap_tx_request_put(lap, req);
+  }
+  irlap_lock_free(lap, txq->lock);
+}
+
+static void irlap_tx_put_requests(struct irlap_tx_queue* txq, struct list_head* requests) {
+  struct irlap* lap = IRLAP_TX_TO_IRLAP(txq);
+  struct list_head *cursor, *next;
+  LIST_FOR_EACH_SAFE(cursor, next, requests) {
+    struct irlap_tx_request* req = LIST_GET_ENTRY(cursor, struct irlap_tx_request, list);
+    LIST_DELETE(&req->list);
+    irlap_tx_request_put(lap, req);
+  }
+}
+
+// Reference prewrapped payloads in place, copy everything else
+static int irlap_tx_request_wrap(struct irlap_tx_request* req, struct irlap_frame* frame, unsigned int additional_bof) {
+  ssize_t len;
+
+  if(frame->wrapped && frame->ref) {
+    len = irlap_wrapper_wrap_prewrapped_iov(IRLAP_FRAME_WRAPPER_ASYNC, req->iov, ARRAY_LEN(req->iov), &req->scratch, frame->hdr, frame->wrapped, additional_bof);
+    if(len < 0) {
+      return len;
+    }
+    req->iovcnt = len;
+    req->ref = frame->ref;
+    irlap_data_buffer_get(req->ref);
+    return 0;
+  }
+
+  len = irlap_frame_burst_wrap(req->data, sizeof(req->data), frame, 1, &additional_bof);
+  if(len < 0) {
+    return len;
+  }
+  req->iov[0].iov_base = req->data;
+  req->iov[0].iov_len = len;
+  req->iovcnt = 1;
+  return 0;
+}
+
+// Append all requests of a burst at once, they must not be interleaved with other bursts
+static int irlap_tx_enqueue(struct irlap_tx_queue* txq, struct list_head* requests) {
+  struct irlap* lap = IRLAP_TX_TO_IRLAP(txq);
+  struct list_head *cursor, *next, *first, *last;
+  int err = 0;
+
+  first = requests->next;
+  last = requests->prev;
+  irlap_lock_take(lap, txq->lock);
+  LIST_FOR_EACH_SAFE(cursor, next, requests) {
+    LIST_DELETE(cursor);
+    LIST_APPEND_TAIL(cursor, &txq->pending);
+  }
+
+  // Only one flush needs to be in flight, it drains all pending requests. The lock is held
+  // until the flush has been scheduled, nobody can queue requests behind a failed attempt
+  if(!txq->flush_pending) {
+    err = irlap_indirect_call(lap, IRLAP_INDIRECTION_TX_FLUSH, NULL);
+    if(err) {
+      IRLAP_TX_LOGE(txq, "Failed to schedule tx queue flush: %d", err);
+      // Take back only our own requests for the caller to release
+      for(cursor = first; cursor != last; cursor = next) {
+        next = cursor->next;
+        LIST_DELETE(cursor);
+        LIST_APPEND_TAIL(cursor, requests);
+      }
+      LIST_DELETE(last);
+      LIST_APPEND_TAIL(last, requests);
+    } else {
+      txq->flush_pending = true;
+    }
+  }
+  irlap_lock_put(lap, txq->lock);
+
+  return err;
+}
+
+// Wrap frames into pooled tx requests and queue them for transmission from the event loop
+static int irlap_tx_queue_requests(struct irlap_tx_queue* txq, struct irlap_frame* frames, size_t num_frames, uint32_t baudrate, unsigned int* additional_bof, irlap_tx_complete_f complete, void* priv) {
+  struct irlap* lap = IRLAP_TX_TO_IRLAP(txq);
+  struct list_head requests;
+  size_t i;
+  int err;
+
+  INIT_LIST_HEAD(requests);
+  for(i = 0; i < num_frames; i++) {
+    struct irlap_tx_request* req = objpool_get(&lap->pools.frames);
+    if(!req) {
+      IRLAP_TX_LOGW(txq, "Frame buffer pool exhausted");
+      err = -ENOBUFS;
+      goto fail_requests;
+    }
+    req->baudrate = baudrate;
+    req->complete = NULL;
+    req->priv = NULL;
+    req->ref = NULL;
+    LIST_APPEND_TAIL(&req->list, &requests);
+
+    err = irlap_tx_request_wrap(req, &frames[i], additional_bof[i]);
+    if(err) {
+      goto fail_requests;
+    }
+
+    if(i == num_frames - 1) {
+      req->complete = complete;
+      req->priv = priv;
+    }
+  }
+
+  err = irlap_tx_enqueue(txq, &requests);
+  if(err) {
+    goto fail_requests;
+  }
+
+  return 0;
+
+fail_requests:
+  irlap_tx_put_requests(txq, &requests);
+  return err;
+}
+
+// Speed and number of additional BOFs are picked from the connection each frame belongs to
+int irlap_tx_queue_frame_burst(struct irlap_tx_queue* txq, struct irlap_frame* frames, size_t num_frames, irlap_tx_complete_f complete, void* priv) {
+  struct irlap* lap = IRLAP_TX_TO_IRLAP(txq);
+  unsigned int additional_bof[IRLAP_FRAME_BURST_MAX];
+  uint32_t baudrate;
+  int err;
+
+  if(num_frames == 0) {
+    return 0;
+  }
+
+  err = irlap_frame_burst_prepare(lap, frames, num_frames, &baudrate, additional_bof);
+  if(err) {
+    return err;
+  }
+  return irlap_tx_queue_requests(txq, frames, num_frames, baudrate, additional_bof, complete, priv);
+}
+
+int irlap_tx_queue_frame(struct irlap_tx_queue* txq, irlap_frame_hdr_t* hdr, struct irlap_data_fragment* fragments, size_t num_fragments, irlap_tx_complete_f complete, void* priv) {
+  struct irlap_frame frame = {
+    .hdr = hdr,
+    .fragments = fragments,
+    .num_fragments = num_fragments,
+  };
+
+  return irlap_tx_queue_frame_burst(txq, &frame, 1, complete, priv);
+}
+
+int irlap_tx_queue_frame_single(struct irlap_tx_queue* txq, irlap_frame_hdr_t* hdr, uint8_t* payload, size_t payload_len, irlap_tx_complete_f complete, void* priv) {
+  struct irlap_data_fragment fragment = {
+    .data = payload,
+    .len = payload_len,
+  };
+
+  return irlap_tx_queue_frame(txq, hdr, &fragment, 1, complete, priv);
+}
+
+// Sent at contention speed no matter what state the connection is in
+int irlap_tx_queue_frame_single_contention(struct irlap_tx_queue* txq, irlap_frame_hdr_t* hdr, uint8_t* payload, size_t payload_len, irlap_tx_complete_f complete, void* priv) {
+  struct irlap_data_fragment fragment = {
+    .data = payload,
+    .len = payload_len,
+  };
+  struct irlap_frame frame = {
+    .hdr = hdr,
+    .fragments = &fragment,
+    .num_fragments = 1,
+  };
+  unsigned int additional_bof = IRLAP_FRAME_ADDITIONAL_BOF_CONTENTION;
+
+  return irlap_tx_queue_requests(txq, &frame, 1, IRLAP_BAUDRATE_CONTENTION, &additional_bof, complete, priv);
+}
+
+static void irlap_tx_complete(struct irlap* lap, struct list_head* requests, int err) {
+  struct list_head *cursor, *next;
+  LIST_FOR_EACH_SAFE(cursor, next, requests) {
+    struct irlap_tx_request* req = LIST_GET_ENTRY(cursor, struct irlap_tx_request, list);
+    irlap_tx_complete_f complete = req->complete;
+    void* priv = req->priv;
+    LIST_DELETE(&req->list);
+    // Release buffer first, completion handlers are likely to queue more frames
+    irlap_tx_request_put(lap, req);
+    if(complete) {
+      complete(lap, err, priv);
+    }
+  }
+}
+
+// Transmit all consecutive requests sharing a baudrate in one tx session
+static void irlap_tx_flush_batch(struct irlap_tx_queue* txq, struct list_head* requests) {
+  struct irlap* lap = IRLAP_TX_TO_IRLAP(txq);
+  struct list_head batch;
+  struct list_head *cursor, *next;
+  struct iovec iov[IRLAP_FRAME_BURST_IOV_MAX];
+  size_t iovcnt = 0;
+  size_t num_requests = 0;
+  uint32_t baudrate = 0;
+  int err;
+
+  INIT_LIST_HEAD(batch);
+  LIST_FOR_EACH_SAFE(cursor, next, requests) {
+    struct irlap_tx_request* req = LIST_GET_ENTRY(cursor, struct irlap_tx_request, list);
+    if(iovcnt > 0 && (req->baudrate != baudrate || iovcnt + req->iovcnt > ARRAY_LEN(iov))) {
+      break;
+    }
+    baudrate = req->baudrate;
+    memcpy(&iov[iovcnt], req->iov, req->iovcnt * sizeof(*iov));
+    iovcnt += req->iovcnt;
+    num_requests++;
+    LIST_DELETE(&req->list);
+    LIST_APPEND_TAIL(&req->list, &batch);
+  }
+
+  IRLAP_TX_LOGV(txq, "Transmitting %zu queued requests at %u baud", num_requests, baudrate);
+  // No need to turn the link around between back to back batches
+  err = irlap_phy_tx(lap, baudrate, iov, iovcnt, !LIST_IS_EMPTY(requests));
+  if(err) {
+    IRLAP_TX_LOGW(txq, "Failed to transmit queued frames: %d", err);
+  }
+  irlap_tx_complete(lap, &batch, err);
+}
+
+void irlap_tx_indirect_flush(struct irlap* lap, void* data) {
+  struct irlap_tx_queue* txq = &lap->tx;
+  struct list_head requests;
+
+  irlap_lock_take(lap, txq->lock);
+  txq->flush_pending = false;
+  list_replace(&txq->pending, &requests);
+  INIT_LIST_HEAD(txq->pending);
+  irlap_lock_put(lap, txq->lock);
+
+  while(!LIST_IS_EMPTY(&requests)) {
+    irlap_tx_flush_batch(txq, &requests);
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "irlap_defs.h"
+#include "../util/list.h"
+
+struct irlap;
+struct irlap_frame;
+struct irlap_data_buffer;
+struct irlap_data_fragment;
+union irlap_frame_hdr;
+
+typedef void (*irlap_tx_complete_f)(struct irlap* lap, int err, void* priv);
+
+// Bof, header, payload and trailer of a prewrapped frame
+#define IRLAP_TX_REQUEST_IOV_MAX 4
+
+// One wrapped frame, allocated from the frame pool. Only the last frame of a burst carries the completion.
+// Prewrapped payloads are referenced through iov, everything else is wrapped into data
+struct irlap_tx_request {
+  struct list_head list;
+  uint32_t baudrate;
+  irlap_tx_complete_f complete;
+  void* priv;
+  struct irlap_data_buffer* ref;
+  struct iovec iov[IRLAP_TX_REQUEST_IOV_MAX];
+  size_t iovcnt;
+  struct irlap_wrapper_iov_scratch scratch;
+  uint8_t data[IRLAP_FRAME_WRAPPED_SIZE(IRLAP_TX_REQUEST_DATA_SIZE)];
+};
+
+struct irlap_tx_queue {
+  struct list_head pending;
+  void* lock;
+  bool flush_pending;
+};
+
+int irlap_tx_init(struct irlap_tx_queue* txq);
+void irlap_tx_free(struct irlap_tx_queue* txq);
+int irlap_tx_queue_frame_burst(struct irlap_tx_queue* txq, struct irlap_frame* frames, size_t num_frames, irlap_tx_complete_f complete, void* priv);
+int irlap_tx_queue_frame(struct irlap_tx_queue* txq, union irlap_frame_hdr* hdr, struct irlap_data_fragment* fragments, size_t num_fragments, irlap_tx_complete_f complete, void* priv);
+int irlap_tx_queue_frame_single(struct irlap_tx_queue* txq, union irlap_frame_hdr* hdr, uint8_t* payload, size_t payload_len, irlap_tx_complete_f complete, void* priv);
+int irlap_tx_queue_frame_single_contention(struct irlap_tx_queue* txq, union irlap_frame_hdr* hdr, uint8_t* payload, size_t payload_len, irlap_tx_complete_f complete, void* priv);
+
+void irlap_tx_indirect_flush(struct irlap* lap, void* data);
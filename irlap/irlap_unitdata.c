@@ -22,9 +22,12 @@ int irlap_unitdata_init(struct irlap_unitdata* udata) {
   int err;
 
   memset(udata, 0, sizeof(*udata));
-  err = irlap_lock_alloc(lap, &udata->ui_timer_lock);
+  udata->ui_timer = IRHAL_TIMER_INVALID;
+  udata->tokens = IRLAP_UNITDATA_BUCKET_SIZE;
+  irhal_now(lap->phy->hal, &udata->last_refill);
+  err = irlap_lock_alloc(lap, &udata->lock);
   if(err) {
-    IRLAP_UDATA_LOGE(udata, "Failed to allocate unitdata timer lock");
+    IRLAP_UDATA_LOGE(udata, "Failed to allocate unitdata lock");
     err = -ENOMEM;
     goto fail;
   }
@@ -35,24 +38,122 @@ fail:
 
 void irlap_unitdata_free(struct irlap_unitdata* udata) {
   struct irlap* lap = IRLAP_UNITDATA_TO_IRLAP(udata);
-  irlap_lock_free(lap, udata->ui_timer_lock);
+  if(udata->ui_timer >= 0) {
+    irlap_clear_timer(lap, udata->ui_timer);
+  }
+  irlap_lock_free(lap, udata->lock);
 }
 
-static void irlap_udata_interval_timeout(void* priv) {
-  struct irlap_unitdata* udata = priv;
+// Add tokens accrued since the last refill, returns ms until the next token is due
+static unsigned int irlap_unitdata_refill(struct irlap_unitdata* udata) {
   struct irlap* lap = IRLAP_UNITDATA_TO_IRLAP(udata);
-  irlap_lock_take(lap, udata->ui_timer_lock);
-  udata->ui_timer = 0;
-  irlap_lock_put(lap, udata->ui_timer_lock);
+  time_ns_t now;
+  time_ns_t elapsed;
+  uint64_t elapsed_ms;
+  uint64_t new_tokens;
+
+  irhal_now(lap->phy->hal, &now);
+  elapsed = now;
+  time_sub(&elapsed, &udata->last_refill);
+  elapsed_ms = time_to_ns(&elapsed) / 1000000ULL;
+  new_tokens = elapsed_ms / IRLAP_UNITDATA_INTERVAL_MS;
+
+  if(udata->tokens + new_tokens >= IRLAP_UNITDATA_BUCKET_SIZE) {
+    udata->tokens = IRLAP_UNITDATA_BUCKET_SIZE;
+    udata->last_refill = now;
+    return IRLAP_UNITDATA_INTERVAL_MS;
+  }
+
+  // Keep the fraction of an interval that has already passed
+  udata->tokens += new_tokens;
+  time_add_ns(&udata->last_refill, new_tokens * IRLAP_UNITDATA_INTERVAL_MS * 1000000ULL);
+  return IRLAP_UNITDATA_INTERVAL_MS - elapsed_ms % IRLAP_UNITDATA_INTERVAL_MS;
 }
 
-int irlap_unitdata_request(struct irlap_unitdata* udata, uint8_t* data, size_t len) {
+static void irlap_unitdata_timeout(void* priv);
+
+static void irlap_unitdata_schedule(struct irlap_unitdata* udata, unsigned int timeout_ms) {
+  struct irlap* lap = IRLAP_UNITDATA_TO_IRLAP(udata);
+  int err = irlap_set_timer(lap, timeout_ms, irlap_unitdata_timeout, udata);
+  if(err < 0) {
+    IRLAP_UDATA_LOGE(udata, "Failed to set unitdata timer, %u frames stuck in queue: %d", udata->queue_len, err);
+    return;
+  }
+  udata->ui_timer = err;
+}
+
+// Send as many queued frames as the shaper allows in one burst, caller must hold the unitdata lock
+static void irlap_unitdata_flush(struct irlap_unitdata* udata) {
   struct irlap* lap = IRLAP_UNITDATA_TO_IRLAP(udata);
-  int err = 0;
   irlap_frame_hdr_t hdr = {
     .connection_address = IRLAP_FRAME_MAKE_ADDRESS_COMMAND(IRLAP_CONNECTION_ADDRESS_BCAST),
     .control = IRLAP_FRAME_FORMAT_UNNUMBERED | IRLAP_CMD_UI | IRLAP_CMD_POLL,
   };
+  struct irlap_data_fragment fragments[IRLAP_UNITDATA_BUCKET_SIZE];
+  struct irlap_frame frames[IRLAP_UNITDATA_BUCKET_SIZE];
+  unsigned int next_token_ms;
+  size_t num_frames;
+  size_t i;
+  int err;
+
+  // Pending timer flushes once it fires
+  if(!udata->queue_len || udata->ui_timer >= 0) {
+    return;
+  }
+
+  next_token_ms = irlap_unitdata_refill(udata);
+  if(!udata->tokens) {
+    irlap_unitdata_schedule(udata, next_token_ms);
+    return;
+  }
+
+  if(irlap_get_state(lap) != IRLAP_STATION_MODE_NDM || irlap_is_media_busy(lap)) {
+    IRLAP_UDATA_LOGV(udata, "Can't send unitdata right now, retrying later");
+    irlap_unitdata_schedule(udata, IRLAP_UNITDATA_RETRY_MS);
+    return;
+  }
+
+  num_frames = min(udata->tokens, udata->queue_len);
+  for(i = 0; i < num_frames; i++) {
+    struct irlap_unitdata_frame* frame = &udata->queue[(udata->queue_head + i) % IRLAP_UNITDATA_QUEUE_LEN];
+    fragments[i].data = frame->data;
+    fragments[i].len = frame->len;
+    frames[i].hdr = &hdr;
+    frames[i].fragments = &fragments[i];
+    frames[i].num_fragments = 1;
+    frames[i].wrapped = NULL;
+    frames[i].ref = NULL;
+  }
+
+  err = irlap_tx_queue_frame_burst(&lap->tx, frames, num_frames, NULL, NULL);
+  if(err) {
+    IRLAP_UDATA_LOGW(udata, "Failed to queue unitdata frames: %d", err);
+    irlap_unitdata_schedule(udata, IRLAP_UNITDATA_RETRY_MS);
+    return;
+  }
+
+  udata->tokens -= num_frames;
+  udata->queue_head = (udata->queue_head + num_frames) % IRLAP_UNITDATA_QUEUE_LEN;
+  udata->queue_len -= num_frames;
+  if(udata->queue_len) {
+    irlap_unitdata_schedule(udata, next_token_ms);
+  }
+}
+
+static void irlap_unitdata_timeout(void* priv) {
+  struct irlap_unitdata* udata = priv;
+  struct irlap* lap = IRLAP_UNITDATA_TO_IRLAP(udata);
+  irlap_lock_take(lap, udata->lock);
+  udata->ui_timer = IRHAL_TIMER_INVALID;
+  irlap_unitdata_flush(udata);
+  irlap_lock_put(lap, udata->lock);
+}
+
+// Queue unitdata frame, it is sent once media, station state and rate limit permit
+int irlap_unitdata_request(struct irlap_unitdata* udata, uint8_t* data, size_t len) {
+  struct irlap* lap = IRLAP_UNITDATA_TO_IRLAP(udata);
+  struct irlap_unitdata_frame* frame;
+  int err = 0;
 
   if(len > IRLAP_UNITDATA_MAX_LEN) {
     IRLAP_UDATA_LOGW(udata, "Overly long Unitdata request with %zu bytes", len);
@@ -61,41 +162,27 @@ int irlap_unitdata_request(struct irlap_unitdata* udata, uint8_t* data, size_t l
   }
 
   irlap_lock_take_reentrant(lap, lap->state_lock);
-  if(lap->state != IRLAP_STATION_MODE_NDM) {
+  if(irlap_get_state(lap) != IRLAP_STATION_MODE_NDM) {
     IRLAP_UDATA_LOGD(udata, "Station not in NDM state, can't send unitdata");
     err = -IRLAP_ERR_STATION_STATE;
     goto fail_state_locked;
   }
 
-  if(irlap_is_media_busy(lap)) {
-    IRLAP_UDATA_LOGW(udata, "Media is busy, can't send unitdata");
-    err = -IRLAP_ERR_MEDIA_BUSY;
-    goto fail_state_locked;
-  }
-
-  irlap_lock_take(lap, udata->ui_timer_lock);
-  if(!IRLAP_UNITDATA_CAN_SEND_FRAME(udata)) {
-    IRLAP_UDATA_LOGD(udata, "Station not in NDM state, can't send unitdata");
-    err = -IRLAP_ERR_UNITDATA_TIME_LIMIT;
-    goto fail_timer_locked;
-  }
-
-  err = irlap_send_frame_single(lap, &hdr, data, len);
-  if(err) {
-    IRLAP_UDATA_LOGW(udata, "Failed to send unitdata frame: %d", err);
-    goto fail_timer_locked;
+  irlap_lock_take(lap, udata->lock);
+  if(udata->queue_len >= IRLAP_UNITDATA_QUEUE_LEN) {
+    IRLAP_UDATA_LOGD(udata, "Unitdata queue full");
+    err = -ENOBUFS;
+    goto fail_locked;
   }
 
-  err = irlap_set_timer(lap, IRLAP_UNITDATA_INTERVAL_MS, irlap_udata_interval_timeout, udata);
-  if(err < 0) {
-    IRLAP_UDATA_LOGW(udata, "Failed to set unitdata interval timer: %d", err);
-    goto fail_timer_locked;
-  }
-  udata->ui_timer = err;
-  err = 0;
+  frame = &udata->queue[(udata->queue_head + udata->queue_len) % IRLAP_UNITDATA_QUEUE_LEN];
+  memcpy(frame->data, data, len);
+  frame->len = len;
+  udata->queue_len++;
+  irlap_unitdata_flush(udata);
 
-fail_timer_locked:
-  irlap_lock_put(lap, udata->ui_timer_lock);
+fail_locked:
+  irlap_lock_put(lap, udata->lock);
 fail_state_locked:
   irlap_lock_put_reentrant(lap, lap->state_lock);
 fail:
@@ -106,8 +193,7 @@ int irlap_unitdata_handle_ui_cmd(struct irlap* lap, struct irlap_connection* con
   struct irlap_unitdata* udata = &lap->unitdata;
   IRLAP_UDATA_LOGD(udata, "Got unitdata cmd");
   if(conn) {
-    IRLAP_UDATA_LOGW(udata, "Unitdata for connections not implemented yet");
-    return -IRLAP_ERR_NOT_IMPLEMENTED;
+    return irlap_data_handle_unitdata(lap, conn, data, len, poll, true);
   }
 
   if(lap->services.unitdata.indication) {
@@ -116,3 +202,12 @@ int irlap_unitdata_handle_ui_cmd(struct irlap* lap, struct irlap_connection* con
 
   return IRLAP_FRAME_HANDLED;
 }
+
+// Responses only exist within a connection
+int irlap_unitdata_handle_ui_resp(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool final) {
+  if(!conn) {
+    IRLAP_UDATA_LOGD(&lap->unitdata, "Ignoring ui resp outside connection");
+    return -IRLAP_ERR_NO_CONNECTION;
+  }
+  return irlap_data_handle_unitdata(lap, conn, data, len, final, false);
+}
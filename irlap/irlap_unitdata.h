@@ -2,10 +2,24 @@
 
 #include <stdint.h>
 
+#include "../util/time.h"
+
 #define IRLAP_UNITDATA_MAX_LEN     384
 #define IRLAP_UNITDATA_INTERVAL_MS 500
 
-#define IRLAP_UNITDATA_CAN_SEND_FRAME(udata) ((udata)->ui_timer == 0)
+// Frames waiting for the shaper, requests fail with -ENOBUFS beyond that
+#ifndef IRLAP_UNITDATA_QUEUE_LEN
+#define IRLAP_UNITDATA_QUEUE_LEN 4
+#endif
+
+// Token bucket depth, frames saved up while idle go out back to back in one burst.
+// Default keeps every frame at least IRLAP_UNITDATA_INTERVAL_MS apart
+#ifndef IRLAP_UNITDATA_BUCKET_SIZE
+#define IRLAP_UNITDATA_BUCKET_SIZE 1
+#endif
+
+// Recheck interval while the media is busy or the station is connected
+#define IRLAP_UNITDATA_RETRY_MS 50
 
 typedef void (*irlap_unitdata_indication_f)(uint8_t* data, size_t len, void* priv);
 
@@ -13,12 +27,24 @@ struct irlap_service_unitdata {
   irlap_unitdata_indication_f indication;
 };
 
+struct irlap_unitdata_frame {
+  size_t len;
+  uint8_t data[IRLAP_UNITDATA_MAX_LEN];
+};
+
 struct irlap_unitdata {
   int ui_timer;
-  void* ui_timer_lock;
+  void* lock;
+  struct irlap_unitdata_frame queue[IRLAP_UNITDATA_QUEUE_LEN];
+  unsigned int queue_head;
+  unsigned int queue_len;
+  // One token per IRLAP_UNITDATA_INTERVAL_MS
+  unsigned int tokens;
+  time_ns_t last_refill;
 };
 
 int irlap_unitdata_init(struct irlap_unitdata* udata);
 void irlap_unitdata_free(struct irlap_unitdata* udata);
 int irlap_unitdata_request(struct irlap_unitdata* udata, uint8_t* data, size_t len);
 int irlap_unitdata_handle_ui_cmd(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool poll);
+int irlap_unitdata_handle_ui_resp(struct irlap* lap, struct irlap_connection* conn, uint8_t* data, size_t len, bool final);
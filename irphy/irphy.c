@@ -14,3 +14,91 @@ int irphy_init(struct irphy* phy, struct irhal* hal, const struct irphy_hal_ops*
   phy->rx_turn_around_latency_us = rx_turn_around_latency_us;
   return 0;
 }
+
+int irphy_set_baudrate(struct irphy* phy, uint32_t rate) {
+  int err;
+
+  if(phy->session.baudrate == rate) {
+    return 0;
+  }
+
+  err = phy->hal_ops.set_baudrate(rate, phy->hal_priv);
+  if(err) {
+    // Hardware state is unknown now, force next call through to hal
+    phy->session.baudrate = 0;
+    return err;
+  }
+  phy->session.baudrate = rate;
+  return 0;
+}
+
+// Switch to rate delay_us after the end of the next tx session, e.g. after an UA frame
+int irphy_set_baudrate_at_turnaround(struct irphy* phy, uint32_t rate, uint32_t delay_us) {
+  phy->session.turnaround_baudrate = rate;
+  phy->session.turnaround_delay_us = delay_us;
+  return 0;
+}
+
+static int irphy_apply_turnaround_baudrate(struct irphy* phy) {
+  uint32_t rate = phy->session.turnaround_baudrate;
+  int err;
+
+  phy->session.turnaround_baudrate = 0;
+  if(rate == phy->session.baudrate) {
+    return 0;
+  }
+
+  if(!phy->hal_ops.set_baudrate_timed) {
+    // Transmission has been drained already, switching right away is as close as we can get
+    return irphy_set_baudrate(phy, rate);
+  }
+
+  err = phy->hal_ops.set_baudrate_timed(rate, phy->session.turnaround_delay_us, phy->hal_priv);
+  if(err) {
+    phy->session.baudrate = 0;
+    return err;
+  }
+  phy->session.baudrate = rate;
+  return 0;
+}
+
+int irphy_tx_enable(struct irphy* phy) {
+  int err;
+
+  if(phy->session.tx_enabled) {
+    return 0;
+  }
+
+  err = phy->hal_ops.tx_enable(phy->hal_priv);
+  if(err) {
+    return err;
+  }
+  phy->session.tx_enabled = true;
+  return 0;
+}
+
+int irphy_tx_disable(struct irphy* phy) {
+  int err;
+
+  if(!phy->session.tx_enabled) {
+    return 0;
+  }
+
+  err = phy->hal_ops.tx_disable(phy->hal_priv);
+  if(err) {
+    return err;
+  }
+  phy->session.tx_enabled = false;
+
+  if(phy->session.turnaround_baudrate) {
+    err = irphy_apply_turnaround_baudrate(phy);
+  }
+  return err;
+}
+
+// Forget cached hal state, must be called if hal has been reset behind our back
+void irphy_session_reset(struct irphy* phy) {
+  phy->session.baudrate = 0;
+  phy->session.tx_enabled = false;
+  phy->session.turnaround_baudrate = 0;
+}
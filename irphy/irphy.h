@@ -1,7 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "../util/time.h"
 #include "../irhal/irhal.h"
@@ -31,22 +33,34 @@ typedef uint16_t irphy_capability_baudrate_t;
 typedef void (*irphy_rx_cb)(struct irphy* phy, irphy_event_t event, void* priv);
 
 typedef int (*irphy_hal_set_baudrate)(uint32_t rate, void* priv);
+// Optional, switches to rate delay_us after the end of the current transmission
+typedef int (*irphy_hal_set_baudrate_timed)(uint32_t rate, uint32_t delay_us, void* priv);
 typedef int (*irphy_hal_tx_enable)(void* priv);
 typedef ssize_t (*irphy_hal_tx)(const void* data, size_t len, void* priv);
+// Optional, transmits all spans in iov back to back
+typedef ssize_t (*irphy_hal_txv)(const struct iovec* iov, size_t iovcnt, void* priv);
 typedef int (*irphy_hal_tx_wait)(void* priv);
 typedef int (*irphy_hal_tx_disable)(void* priv);
 typedef int (*irphy_hal_rx_enable)(const struct irphy* phy, void* priv, irphy_rx_cb cb, void* cb_priv);
 typedef ssize_t (*irphy_hal_rx)(void* data, size_t len, void* priv);
+// Optional, returns length of contiguous span of received data at *data without consuming it
+typedef ssize_t (*irphy_hal_rx_peek)(const void** data, void* priv);
+// Optional, releases len bytes of the span returned by rx_peek
+typedef int (*irphy_hal_rx_consume)(size_t len, void* priv);
 typedef int (*irphy_hal_rx_disable)(void* priv);
 
 struct irphy_hal_ops {
   irphy_hal_set_baudrate          set_baudrate;
+  irphy_hal_set_baudrate_timed    set_baudrate_timed;
   irphy_hal_tx_enable             tx_enable;
   irphy_hal_tx                    tx;
+  irphy_hal_txv                   txv;
   irphy_hal_tx_wait               tx_wait;
   irphy_hal_tx_disable            tx_disable;
   irphy_hal_rx_enable             rx_enable;
   irphy_hal_rx                    rx;
+  irphy_hal_rx_peek               rx_peek;
+  irphy_hal_rx_consume            rx_consume;
   irphy_hal_rx_disable            rx_disable;
 };
 
@@ -61,6 +75,13 @@ struct irphy {
   } cd;
   irphy_capability_baudrate_t supported_baudrates;
   uint32_t rx_turn_around_latency_us;
+  // Last state passed to hal, avoids redundant hal calls
+  struct {
+    uint32_t baudrate;
+    bool tx_enabled;
+    uint32_t turnaround_baudrate;
+    uint32_t turnaround_delay_us;
+  } session;
 };
 
 int irphy_init(struct irphy* phy, struct irhal* hal, const struct irphy_hal_ops* hal_ops, irphy_capability_baudrate_t supported_baudrates, uint32_t rx_turn_around_latency_us);
@@ -73,24 +94,30 @@ static inline uint32_t irphy_get_rx_turn_around_latency_us(struct irphy* phy) {
   return phy->rx_turn_around_latency_us;
 }
 
-static inline int irphy_set_baudrate(struct irphy* phy, uint32_t rate) {
-  return phy->hal_ops.set_baudrate(rate, phy->hal_priv);
-}
+int irphy_set_baudrate(struct irphy* phy, uint32_t rate);
+int irphy_set_baudrate_at_turnaround(struct irphy* phy, uint32_t rate, uint32_t delay_us);
+int irphy_tx_enable(struct irphy* phy);
+int irphy_tx_disable(struct irphy* phy);
+void irphy_session_reset(struct irphy* phy);
 
-static inline int irphy_tx_enable(struct irphy* phy) {
-  return phy->hal_ops.tx_enable(phy->hal_priv);
+static inline uint32_t irphy_get_baudrate(struct irphy* phy) {
+  return phy->session.baudrate;
 }
 
 static inline ssize_t irphy_tx(struct irphy* phy, const void* data, size_t len) {
   return phy->hal_ops.tx(data, len, phy->hal_priv);
 }
 
-static inline int irphy_tx_wait(struct irphy* phy) {
-  return phy->hal_ops.tx_wait(phy->hal_priv);
+static inline bool irphy_has_txv(struct irphy* phy) {
+  return !!phy->hal_ops.txv;
 }
 
-static inline int irphy_tx_disable(struct irphy* phy) {
-  return phy->hal_ops.tx_disable(phy->hal_priv);
+static inline ssize_t irphy_txv(struct irphy* phy, const struct iovec* iov, size_t iovcnt) {
+  return phy->hal_ops.txv(iov, iovcnt, phy->hal_priv);
+}
+
+static inline int irphy_tx_wait(struct irphy* phy) {
+  return phy->hal_ops.tx_wait(phy->hal_priv);
 }
 
 static inline int irphy_rx_enable(const struct irphy* phy, irphy_rx_cb cb, void* cb_priv) {
@@ -101,6 +128,18 @@ static inline ssize_t irphy_rx(struct irphy* phy, void* data, size_t len) {
   return phy->hal_ops.rx(data, len, phy->hal_priv);
 }
 
+static inline bool irphy_has_rx_peek(struct irphy* phy) {
+  return phy->hal_ops.rx_peek && phy->hal_ops.rx_consume;
+}
+
+static inline ssize_t irphy_rx_peek(struct irphy* phy, const void** data) {
+  return phy->hal_ops.rx_peek(data, phy->hal_priv);
+}
+
+static inline int irphy_rx_consume(struct irphy* phy, size_t len) {
+  return phy->hal_ops.rx_consume(len, phy->hal_priv);
+}
+
 static inline int irphy_rx_disable(struct irphy* phy) {
   return phy->hal_ops.rx_disable(phy->hal_priv);
 }
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../irlap/irlap_negotiation.h"
+
+// Maximum line capacity in bytes at 500ms max turn around time, IrLAP specification v1.1 table 3
+static const struct irlap_negotiation_base_line_capacity line_capacity_500ms[] = {
+  {    9600,    400 },
+  {   19200,    800 },
+  {   38400,   1600 },
+  {   57600,   2360 },
+  {  115200,   4800 },
+  {  576000,  28800 },
+  { 1152000,  57600 },
+  { 4000000, 200000 },
+};
+
+static const uint32_t baudrates[] = { 2400, 9600, 19200, 38400, 57600, 115200, 576000, 1152000, 4000000 };
+static const uint16_t max_turn_around_times_ms[] = { 50, 100, 250, 500 };
+static const uint16_t min_turn_around_times_us[] = { 0, 10, 50, 100, 500, 1000, 5000, 10000 };
+static const uint8_t additional_bofs[] = { 0, 1, 12, 48 };
+static const uint32_t bit_error_rates_ppb[] = { 0, 1, 100, 10000, 1000000, 100000000, IRLAP_NEGOTIATION_BER_SCALE };
+
+static unsigned int num_cases;
+static unsigned int num_failures;
+
+static uint32_t get_line_capacity(uint32_t baudrate, uint16_t turn_around_time_ms) {
+  unsigned int i;
+
+  for(i = 0; i < ARRAY_LEN(line_capacity_500ms); i++) {
+    if(line_capacity_500ms[i].baudrate == baudrate) {
+      return line_capacity_500ms[i].capacity * turn_around_time_ms / 500;
+    }
+  }
+  return 0;
+}
+
+// A window of frames plus the remote's turn around must fit into the line capacity
+static bool is_feasible(const irlap_negotiation_values_t* limits, uint16_t turn_around_time_ms, uint16_t data_size, uint8_t window_size) {
+  uint64_t turn_around_bytes = (uint64_t)limits->baudrate / 10 * limits->min_turn_around_time_us / 1000000;
+  uint64_t frame_bytes = data_size + IRLAP_NEGOTIATION_FRAME_OVERHEAD + limits->additional_bofs;
+
+  if(limits->baudrate < 115200 && turn_around_time_ms != 500) {
+    return false;
+  }
+  return window_size * frame_bytes + turn_around_bytes <= get_line_capacity(limits->baudrate, turn_around_time_ms);
+}
+
+static bool has_feasible_solution(const irlap_negotiation_values_t* limits) {
+  unsigned int i;
+
+  for(i = 0; i < ARRAY_LEN(max_turn_around_times_ms); i++) {
+    if(max_turn_around_times_ms[i] <= limits->max_turn_around_time_ms &&
+       is_feasible(limits, max_turn_around_times_ms[i], IRLAP_NEGOTIATION_DATA_SIZE_MIN, 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_turn_around_time(uint16_t turn_around_time_ms) {
+  unsigned int i;
+
+  for(i = 0; i < ARRAY_LEN(max_turn_around_times_ms); i++) {
+    if(max_turn_around_times_ms[i] == turn_around_time_ms) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void fail(const irlap_negotiation_values_t* limits, uint32_t ber, const irlap_negotiation_values_t* res, int err, const char* reason) {
+  num_failures++;
+  fprintf(stderr, "FAIL: %s\n", reason);
+  fprintf(stderr, "  baudrate %u, max turn around %ums, window %u, data size %u, min turn around %uus, bofs %u, ber %uppb\n",
+          limits->baudrate, limits->max_turn_around_time_ms, limits->window_size, limits->data_size,
+          limits->min_turn_around_time_us, limits->additional_bofs, ber);
+  fprintf(stderr, "  -> err %d, window %u, data size %u, turn around %ums\n",
+          err, res->window_size, res->data_size, res->max_turn_around_time_ms);
+}
+
+static void check(const irlap_negotiation_values_t* limits, uint32_t ber) {
+  irlap_negotiation_values_t res = *limits;
+  int err;
+
+  num_cases++;
+  err = irlap_negotiation_solve_tx_values(&res, ber);
+  if(err) {
+    if(has_feasible_solution(limits)) {
+      fail(limits, ber, &res, err, "no solution found although one exists");
+    }
+    return;
+  }
+
+  if(!has_feasible_solution(limits)) {
+    fail(limits, ber, &res, err, "solution found although none exists");
+    return;
+  }
+  if(res.baudrate != limits->baudrate || res.additional_bofs != limits->additional_bofs ||
+     res.min_turn_around_time_us != limits->min_turn_around_time_us) {
+    fail(limits, ber, &res, err, "fixed parameter modified");
+  }
+  if(res.window_size < 1 || res.window_size > limits->window_size) {
+    fail(limits, ber, &res, err, "window size out of range");
+  }
+  if(res.data_size < IRLAP_NEGOTIATION_DATA_SIZE_MIN || res.data_size > limits->data_size ||
+     (res.data_size & (res.data_size - 1))) {
+    fail(limits, ber, &res, err, "data size out of range");
+  }
+  if(!is_turn_around_time(res.max_turn_around_time_ms) || res.max_turn_around_time_ms > limits->max_turn_around_time_ms) {
+    fail(limits, ber, &res, err, "turn around time out of range");
+  }
+  if(!is_feasible(limits, res.max_turn_around_time_ms, res.data_size, res.window_size)) {
+    fail(limits, ber, &res, err, "window exceeds line capacity");
+  }
+}
+
+int main(void) {
+  unsigned int baud, turn, window, data_size, min_turn, bof, ber;
+
+  for(baud = 0; baud < ARRAY_LEN(baudrates); baud++) {
+    for(turn = 0; turn < ARRAY_LEN(max_turn_around_times_ms); turn++) {
+      for(window = 1; window <= 7; window++) {
+        for(data_size = IRLAP_NEGOTIATION_DATA_SIZE_MIN; data_size <= IRLAP_MAX_DATA_SIZE; data_size *= 2) {
+          for(min_turn = 0; min_turn < ARRAY_LEN(min_turn_around_times_us); min_turn++) {
+            for(bof = 0; bof < ARRAY_LEN(additional_bofs); bof++) {
+              irlap_negotiation_values_t limits = {
+                .baudrate = baudrates[baud],
+                .max_turn_around_time_ms = max_turn_around_times_ms[turn],
+                .data_size = data_size,
+                .window_size = window,
+                .additional_bofs = additional_bofs[bof],
+                .min_turn_around_time_us = min_turn_around_times_us[min_turn],
+                .disconnect_threshold_time_s = 30,
+              };
+              for(ber = 0; ber < ARRAY_LEN(bit_error_rates_ppb); ber++) {
+                check(&limits, bit_error_rates_ppb[ber]);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  printf("%u cases, %u failures\n", num_cases, num_failures);
+  return num_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
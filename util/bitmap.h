@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef uint32_t bitmap_word_t;
+
+#define BITMAP_WORD_BITS (sizeof(bitmap_word_t) * 8)
+#define BITMAP_NUM_WORDS(bits) (((bits) + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+#define BITMAP_DECLARE(name, bits) bitmap_word_t name[BITMAP_NUM_WORDS(bits)]
+
+static inline void bitmap_set(bitmap_word_t* map, unsigned int bit) {
+  map[bit / BITMAP_WORD_BITS] |= (bitmap_word_t)1 << (bit % BITMAP_WORD_BITS);
+}
+
+static inline void bitmap_clear(bitmap_word_t* map, unsigned int bit) {
+  map[bit / BITMAP_WORD_BITS] &= ~((bitmap_word_t)1 << (bit % BITMAP_WORD_BITS));
+}
+
+static inline bool bitmap_test(const bitmap_word_t* map, unsigned int bit) {
+  return !!(map[bit / BITMAP_WORD_BITS] & ((bitmap_word_t)1 << (bit % BITMAP_WORD_BITS)));
+}
+
+// Number of set bits in bitmap
+static inline size_t bitmap_weight(const bitmap_word_t* map, size_t num_words) {
+  size_t weight = 0;
+  while(num_words-- > 0) {
+    weight += __builtin_popcount(*map++);
+  }
+  return weight;
+}
+
+// Index of the n-th (zero based) set bit in bitmap, -1 if there are less than n + 1 bits set
+static inline ssize_t bitmap_select(const bitmap_word_t* map, size_t num_words, size_t n) {
+  size_t word_idx;
+  for(word_idx = 0; word_idx < num_words; word_idx++) {
+    bitmap_word_t word = map[word_idx];
+    size_t weight = __builtin_popcount(word);
+    if(n >= weight) {
+      n -= weight;
+      continue;
+    }
+    // Drop the n lowest set bits, the n-th set bit is the lowest one left
+    while(n-- > 0) {
+      word &= word - 1;
+    }
+    return word_idx * BITMAP_WORD_BITS + __builtin_ctz(word);
+  }
+  return -1;
+}
@@ -37,3 +37,64 @@ uint16_t irda_crc_ccitt_update(uint16_t crc, uint8_t* data, size_t len) {
 uint16_t irda_crc_ccitt_final(uint16_t crc) {
   return crc16_final(crc);
 }
+
+// Multiply vector by 16x16 matrix over GF(2), one column per bit
+static uint16_t crc16_matrix_times(const uint16_t* mat, uint16_t vec) {
+  uint16_t sum = 0;
+  while(vec) {
+    if(vec & 1) {
+      sum ^= *mat;
+    }
+    vec >>= 1;
+    mat++;
+  }
+  return sum;
+}
+
+static void crc16_matrix_square(uint16_t* square, const uint16_t* mat) {
+  unsigned int i;
+  for(i = 0; i < 16; i++) {
+    square[i] = crc16_matrix_times(mat, mat[i]);
+  }
+}
+
+// Advance crc register over len zero bytes in O(log(len))
+static uint16_t crc16_shift_zeros(uint16_t crc, uint16_t poly, size_t len) {
+  uint16_t even[16];
+  uint16_t odd[16];
+  unsigned int i;
+
+  // Operator for a single zero bit
+  odd[0] = poly;
+  for(i = 1; i < 16; i++) {
+    odd[i] = 1 << (i - 1);
+  }
+  // Two, then four zero bits
+  crc16_matrix_square(even, odd);
+  crc16_matrix_square(odd, even);
+
+  // Alternate between the two buffers, squaring up from one zero byte
+  do {
+    crc16_matrix_square(even, odd);
+    if(len & 1) {
+      crc = crc16_matrix_times(even, crc);
+    }
+    len >>= 1;
+    if(!len) {
+      break;
+    }
+    crc16_matrix_square(odd, even);
+    if(len & 1) {
+      crc = crc16_matrix_times(odd, crc);
+    }
+    len >>= 1;
+  } while(len);
+
+  return crc;
+}
+
+// Final crc of a message after xoring one of its bytes with delta, trailing_len bytes follow that byte
+uint16_t irda_crc_ccitt_patch(uint16_t crc, uint8_t delta, size_t trailing_len) {
+  uint16_t diff = crc16_update(0, IRDA_CRC_POLY_CCITT, &delta, 1);
+  return crc ^ crc16_shift_zeros(diff, IRDA_CRC_POLY_CCITT, trailing_len);
+}
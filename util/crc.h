@@ -8,3 +8,4 @@
 uint16_t irda_crc_ccitt_init();
 uint16_t irda_crc_ccitt_update(uint16_t crc, uint8_t* data, size_t len);
 uint16_t irda_crc_ccitt_final(uint16_t crc);
+uint16_t irda_crc_ccitt_patch(uint16_t crc, uint8_t delta, size_t trailing_len);
@@ -10,11 +10,18 @@ int eventqueue_init(struct eventqueue* queue, struct irhal* hal, size_t size) {
   memset(queue, 0, sizeof(*queue));
   queue->hal = hal;
 
+#ifdef IRDA_STATIC_ALLOC
+  if(size > EVENTQUEUE_SIZE_STATIC) {
+    err = -EINVAL;
+    goto fail;
+  }
+#else
   queue->events = calloc(size, sizeof(struct event));
   if(!queue->events) {
     err = -ENOMEM;
     goto fail;
   }
+#endif
 
   queue->size = size;
 
@@ -33,7 +40,9 @@ int eventqueue_init(struct eventqueue* queue, struct irhal* hal, size_t size) {
 fail_work_lock_alloc:
   irhal_lock_free(hal, queue->work_lock);
 fail_queue_alloc:
+#ifndef IRDA_STATIC_ALLOC
   free(queue->events);
+#endif
 fail:
   return err;
 }
@@ -41,7 +50,9 @@ fail:
 void eventqueue_free(struct eventqueue* queue) {
   irhal_lock_free(queue->hal, queue->data_lock);
   irhal_lock_free(queue->hal, queue->work_lock);
+#ifndef IRDA_STATIC_ALLOC
   free(queue->events);
+#endif
 }
 
 int eventqueue_enqueue(struct eventqueue* queue, int type, void* data) {
@@ -4,6 +4,11 @@
 
 #include "../irhal/irhal.h"
 
+// Fixed queue capacity with IRDA_STATIC_ALLOC
+#ifndef EVENTQUEUE_SIZE_STATIC
+#define EVENTQUEUE_SIZE_STATIC 32
+#endif
+
 struct event {
   int type;
   void* data;
@@ -13,7 +18,11 @@ struct eventqueue {
   struct irhal* hal;
   void* work_lock;
   void* data_lock;
+#ifdef IRDA_STATIC_ALLOC
+  struct event events[EVENTQUEUE_SIZE_STATIC];
+#else
   struct event* events;
+#endif
   size_t size;
   size_t num_events;
 };
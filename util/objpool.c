@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "objpool.h"
+
+#define OBJPOOL_HEAD(tag, idx) (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+#define OBJPOOL_HEAD_TAG(head) ((uint32_t)((head) >> 32))
+#define OBJPOOL_HEAD_INDEX(head) ((uint32_t)(head))
+
+int objpool_init_static(struct objpool* pool, void* storage, _Atomic(uint32_t)* next, size_t obj_size, size_t num_objs) {
+  size_t i;
+
+  if(num_objs >= OBJPOOL_INDEX_NONE) {
+    return -EINVAL;
+  }
+
+  memset(pool, 0, sizeof(*pool));
+  pool->storage = storage;
+  pool->next = next;
+  pool->obj_size = obj_size;
+  pool->num_objs = num_objs;
+
+  for(i = 0; i < num_objs; i++) {
+    atomic_init(&pool->next[i], i + 1 < num_objs ? i + 1 : OBJPOOL_INDEX_NONE);
+  }
+  atomic_init(&pool->head, OBJPOOL_HEAD(0, num_objs ? 0 : OBJPOOL_INDEX_NONE));
+  atomic_init(&pool->in_use, 0);
+  atomic_init(&pool->high_water, 0);
+  atomic_init(&pool->exhausted, 0);
+
+  return 0;
+}
+
+int objpool_init(struct objpool* pool, size_t obj_size, size_t num_objs) {
+  size_t align = _Alignof(max_align_t);
+  void* storage;
+  _Atomic(uint32_t)* next;
+  int err;
+
+  obj_size = (obj_size + align - 1) / align * align;
+  storage = malloc(obj_size * num_objs);
+  if(!storage && num_objs) {
+    err = -ENOMEM;
+    goto fail;
+  }
+
+  next = calloc(num_objs, sizeof(*next));
+  if(!next && num_objs) {
+    err = -ENOMEM;
+    goto fail_storage;
+  }
+
+  err = objpool_init_static(pool, storage, next, obj_size, num_objs);
+  if(err) {
+    goto fail_next;
+  }
+  pool->owns_storage = true;
+
+  return 0;
+
+fail_next:
+  free(next);
+fail_storage:
+  free(storage);
+fail:
+  return err;
+}
+
+void objpool_free(struct objpool* pool) {
+  if(pool->owns_storage) {
+    free(pool->next);
+    free(pool->storage);
+  }
+}
+
+void* objpool_get(struct objpool* pool) {
+  uint64_t head = atomic_load_explicit(&pool->head, memory_order_acquire);
+  uint64_t new_head;
+  uint32_t idx;
+  size_t in_use, high_water;
+
+  do {
+    idx = OBJPOOL_HEAD_INDEX(head);
+    if(idx == OBJPOOL_INDEX_NONE) {
+      atomic_fetch_add_explicit(&pool->exhausted, 1, memory_order_relaxed);
+      return NULL;
+    }
+    new_head = OBJPOOL_HEAD(OBJPOOL_HEAD_TAG(head) + 1, atomic_load_explicit(&pool->next[idx], memory_order_relaxed));
+  } while(!atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head, memory_order_acq_rel, memory_order_acquire));
+
+  in_use = atomic_fetch_add_explicit(&pool->in_use, 1, memory_order_relaxed) + 1;
+  high_water = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+  while(in_use > high_water &&
+        !atomic_compare_exchange_weak_explicit(&pool->high_water, &high_water, in_use, memory_order_relaxed, memory_order_relaxed));
+
+  return pool->storage + (size_t)idx * pool->obj_size;
+}
+
+void objpool_put(struct objpool* pool, void* obj) {
+  uint32_t idx = ((uint8_t*)obj - pool->storage) / pool->obj_size;
+  uint64_t head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+  uint64_t new_head;
+
+  // Account before pushing so in_use never exceeds the pool size
+  atomic_fetch_sub_explicit(&pool->in_use, 1, memory_order_relaxed);
+  do {
+    atomic_store_explicit(&pool->next[idx], OBJPOOL_HEAD_INDEX(head), memory_order_relaxed);
+    new_head = OBJPOOL_HEAD(OBJPOOL_HEAD_TAG(head) + 1, idx);
+  } while(!atomic_compare_exchange_weak_explicit(&pool->head, &head, new_head, memory_order_release, memory_order_relaxed));
+}
+
+void objpool_get_stats(struct objpool* pool, struct objpool_stats* stats) {
+  stats->size = pool->num_objs;
+  stats->in_use = atomic_load_explicit(&pool->in_use, memory_order_relaxed);
+  stats->high_water = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+  stats->exhausted = atomic_load_explicit(&pool->exhausted, memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "util.h"
+
+#define OBJPOOL_INDEX_NONE UINT32_MAX
+
+// Fixed size object pool with a lock-free free list
+struct objpool {
+  uint8_t* storage;
+  size_t obj_size;
+  size_t num_objs;
+  _Atomic(uint32_t)* next;
+  // Free list head, tag in upper half guards against ABA
+  _Atomic(uint64_t) head;
+  atomic_size_t in_use;
+  atomic_size_t high_water;
+  atomic_size_t exhausted;
+  bool owns_storage;
+};
+
+// Storage for pools living inside another structure, see objpool_init_storage
+#define OBJPOOL_STORAGE_DECLARE(name, type, num) \
+  struct { \
+    type objs[num]; \
+    _Atomic(uint32_t) next[num]; \
+  } name
+
+#define objpool_init_storage(pool, storage) \
+  objpool_init_static((pool), (storage)->objs, (storage)->next, sizeof(*(storage)->objs), ARRAY_LEN((storage)->objs))
+
+struct objpool_stats {
+  size_t size;
+  size_t in_use;
+  size_t high_water;
+  size_t exhausted;
+};
+
+int objpool_init(struct objpool* pool, size_t obj_size, size_t num_objs);
+int objpool_init_static(struct objpool* pool, void* storage, _Atomic(uint32_t)* next, size_t obj_size, size_t num_objs);
+void objpool_free(struct objpool* pool);
+void* objpool_get(struct objpool* pool);
+void objpool_put(struct objpool* pool, void* obj);
+void objpool_get_stats(struct objpool* pool, struct objpool_stats* stats);
+
+static inline bool objpool_owns(const struct objpool* pool, const void* obj) {
+  const uint8_t* ptr = obj;
+  return ptr >= pool->storage && ptr < pool->storage + pool->obj_size * pool->num_objs;
+}